@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "barrier.h"
+
+// Set in a flag word by a waiter about to sleep on it.
+#define SLEEPING 0x80000000u
+
+static void futex_wait(atomic_uint *addr, unsigned int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static inline void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Waits until word reaches target, polling spins times before parking.
+static void awaitValue(atomic_uint *word, unsigned int target, int spins) {
+    unsigned int v;
+    for (int i = 0; i < spins; i++) {
+        v = atomic_load_explicit(word, memory_order_acquire);
+        if ((v & ~SLEEPING) >= target)
+            return;
+        cpuRelax();
+    }
+    v = atomic_load_explicit(word, memory_order_acquire);
+    while ((v & ~SLEEPING) < target) {
+        if (!(v & SLEEPING) && !atomic_compare_exchange_weak(word, &v, v | SLEEPING))
+            continue;
+        futex_wait(word, v | SLEEPING);
+        v = atomic_load_explicit(word, memory_order_acquire);
+    }
+}
+
+// Stores value in word, waking whoever has gone to sleep on it.
+static void publishValue(atomic_uint *word, unsigned int value, int waiters) {
+    if (atomic_exchange(word, value) & SLEEPING)
+        futex_wake(word, waiters);
+}
+
+/*
+ * Function: barrier_init
+ * --------------------------
+ * Sets up b for count participants with ids 0 to count - 1.
+ *
+ * returns: 0 on success, -1 if type is not implemented here or the
+ * dissemination flags could not be allocated.
+ * */
+int barrier_init(barrier_t *b, barrier_type type, unsigned int count) {
+    memset(b, 0, sizeof(*b));
+    b->type = type;
+    b->count = count;
+    b->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? BARRIER_SPINS : 0;
+    atomic_init(&b->arrived, 0);
+    atomic_init(&b->generation, 0);
+    switch (type) {
+        case BARRIER_CENTRAL:
+            return 0;
+        case BARRIER_DISSEMINATION:
+            while (b->rounds < BARRIER_MAX_ROUNDS && (1u << b->rounds) < count)
+                b->rounds++;
+            if ((1u << b->rounds) < count)
+                return -1;
+            b->flags = aligned_alloc(BARRIER_CACHE_LINE, count * sizeof(barrier_flags_t));
+            if (b->flags == NULL)
+                return -1;
+            memset(b->flags, 0, count * sizeof(barrier_flags_t));
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * Function: barrier_wait
+ * --------------------------
+ * Blocks participant id until all count participants have arrived.
+ *
+ * returns: PTHREAD_BARRIER_SERIAL_THREAD for one participant (the last
+ * to arrive, or id 0 with DISSEMINATION), 0 for the rest.
+ * */
+int barrier_wait(barrier_t *b, unsigned int id) {
+    if (b->type == BARRIER_CENTRAL) {
+        // The generation cannot move on before we arrive, so reading it first is safe.
+        unsigned int generation = atomic_load(&b->generation) & ~SLEEPING;
+        if (atomic_fetch_add(&b->arrived, 1) == b->count - 1) {
+            atomic_store(&b->arrived, 0);
+            publishValue(&b->generation, generation + 1, INT_MAX);
+            return PTHREAD_BARRIER_SERIAL_THREAD;
+        }
+        awaitValue(&b->generation, generation + 1, b->spins);
+        return 0;
+    }
+
+    barrier_flags_t *own = &b->flags[id];
+    unsigned int episode = ++own->episode;
+    for (unsigned int k = 0; k < b->rounds; k++) {
+        unsigned int partner = (id + (1u << k)) % b->count;
+        // Each flag has one sender, so the values it sees never go backwards.
+        publishValue(&b->flags[partner].round[k], episode, 1);
+        awaitValue(&own->round[k], episode, b->spins);
+    }
+    return id == 0 ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+}
+
+void barrier_destroy(barrier_t *b) {
+    free(b->flags);
+    b->flags = NULL;
+}
+
+const char *barrier_type_name(barrier_type type) {
+    switch (type) {
+        case BARRIER_PTHREAD:
+            return "pthread";
+        case BARRIER_CENTRAL:
+            return "central";
+        case BARRIER_DISSEMINATION:
+            return "dissemination";
+    }
+    return "?";
+}
+
+// returns: 0 and sets type if name is a barrier type, -1 otherwise.
+int barrier_parse_type(const char *name, barrier_type *type) {
+    for (barrier_type t = BARRIER_PTHREAD; t <= BARRIER_DISSEMINATION; t++) {
+        if (strcmp(name, barrier_type_name(t)) == 0) {
+            *type = t;
+            return 0;
+        }
+    }
+    return -1;
+}
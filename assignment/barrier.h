@@ -0,0 +1,58 @@
+#ifndef ASSIGNMENT_BARRIER_H
+#define ASSIGNMENT_BARRIER_H
+
+#include <stdatomic.h>
+
+#define BARRIER_SPINS 128       // Polls before a waiter parks, on machines with more than one CPU.
+#define BARRIER_MAX_ROUNDS 16   // Dissemination rounds: enough for 65536 participants.
+#define BARRIER_CACHE_LINE 64
+
+typedef enum barrier_type {
+    BARRIER_PTHREAD,       // pthread_barrier_t (not implemented here).
+    BARRIER_CENTRAL,
+    BARRIER_DISSEMINATION
+} barrier_type;
+
+/*
+ * One participant's incoming dissemination flags, one per round. The
+ * flags hold episode numbers, which only grow, so they never need
+ * resetting between episodes.
+ */
+typedef struct barrier_flags {
+    atomic_uint round[BARRIER_MAX_ROUNDS];
+    unsigned int episode; // Only touched by the owner.
+    char pad[BARRIER_CACHE_LINE - sizeof(unsigned int)];
+} barrier_flags_t;
+
+/*
+ * Spin-then-park barriers for plain threads. Waiters poll for a while,
+ * then sleep on a futex; releasers only make the wake syscall when a
+ * waiter has flagged that it is asleep.
+ *
+ * CENTRAL: a sense-reversing barrier. One arrival counter, and the
+ *   sense is the generation number, so a waiter's local sense is just
+ *   the generation it arrived in.
+ * DISSEMINATION: ceil(log2(count)) rounds; in round k participant i
+ *   signals (i + 2^k) mod count and waits for its own flag. No shared
+ *   counter and no herd wakeup, at the cost of O(log n) steps each.
+ */
+typedef struct barrier {
+    barrier_type type;
+    unsigned int count;
+    unsigned int rounds;
+    int spins; // 0 on a single CPU, where polling only delays whoever we wait for.
+    char pad0[BARRIER_CACHE_LINE];
+    atomic_uint arrived;
+    char pad1[BARRIER_CACHE_LINE];
+    atomic_uint generation;
+    char pad2[BARRIER_CACHE_LINE];
+    barrier_flags_t *flags; // count entries, DISSEMINATION only.
+} barrier_t;
+
+int barrier_init(barrier_t *b, barrier_type type, unsigned int count);
+int barrier_wait(barrier_t *b, unsigned int id);
+void barrier_destroy(barrier_t *b);
+const char *barrier_type_name(barrier_type type);
+int barrier_parse_type(const char *name, barrier_type *type);
+
+#endif //ASSIGNMENT_BARRIER_H
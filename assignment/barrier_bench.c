@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sync.h"
+
+#define DEFAULT_EPISODES 2000
+#define DEFAULT_MAX_PARTICIPANTS 1024
+
+typedef struct bench_thread_t {
+    sync_barrier_t *barrier;
+    unsigned int id;
+    int episodes;
+} bench_thread_t;
+
+static uint64_t monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *participant(void *args) {
+    bench_thread_t *t = (bench_thread_t *)args;
+    for (int i = 0; i < t->episodes; i++)
+        sync_barrier_wait(t->barrier, t->id);
+    return NULL;
+}
+
+/*
+ * Function: measure
+ * --------------------------
+ * Runs episodes barrier episodes with participants threads, after one
+ * warm-up episode so that thread start-up is not timed.
+ *
+ * returns: mean ns per episode, or -1 if the barrier could not be
+ * created.
+ * */
+static double measure(barrier_type type, unsigned int participants, int episodes) {
+    sync_barrier_t barrier;
+    if (sync_barrier_init(&barrier, 0, type, participants) != 0)
+        return -1;
+    pthread_t *threads = calloc(participants, sizeof(pthread_t));
+    bench_thread_t *data = calloc(participants, sizeof(bench_thread_t));
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    for (unsigned int i = 1; i < participants; i++) {
+        data[i] = (bench_thread_t){&barrier, i, episodes + 1};
+        if (pthread_create(&threads[i], &attr, participant, &data[i]) != 0) {
+            // The threads already started are stuck at the barrier.
+            printf("ERROR(measure); could only start %u of %u threads\n", i, participants);
+            exit(-1);
+        }
+    }
+    sync_barrier_wait(&barrier, 0);
+    uint64_t start = monotonicNow();
+    for (int i = 0; i < episodes; i++)
+        sync_barrier_wait(&barrier, 0);
+    double result = (double)(monotonicNow() - start) / episodes;
+    for (unsigned int i = 1; i < participants; i++)
+        pthread_join(threads[i], NULL);
+    pthread_attr_destroy(&attr);
+    free(threads);
+    free(data);
+    sync_barrier_destroy(&barrier);
+    return result;
+}
+
+/*
+ * barrier_bench
+ * Prints the mean latency of one barrier episode for every barrier type
+ * at 2, 4, 8... participants up to the maximum.
+ * */
+int main(int argc, char *argv[]) {
+    int episodes = DEFAULT_EPISODES;
+    unsigned int maxParticipants = DEFAULT_MAX_PARTICIPANTS;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:p:")) != -1) {
+        switch (opt) {
+            case 'e':
+                episodes = atoi(optarg);
+                break;
+            case 'p':
+                maxParticipants = (unsigned int)atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-e episodes] [-p max participants]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (episodes < 1 || maxParticipants < 2) {
+        fprintf(stderr, "Usage: %s [-e episodes] [-p max participants]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%12s", "participants");
+    for (barrier_type t = BARRIER_PTHREAD; t <= BARRIER_DISSEMINATION; t++)
+        printf(" %16s", barrier_type_name(t));
+    printf("   (ns per episode, %d episodes)\n", episodes);
+    for (unsigned int p = 2; p <= maxParticipants; p *= 2) {
+        printf("%12u", p);
+        for (barrier_type t = BARRIER_PTHREAD; t <= BARRIER_DISSEMINATION; t++)
+            printf(" %16.0f", measure(t, p, episodes));
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
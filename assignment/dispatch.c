@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dispatch.h"
+
+// Called with the mutex held.
+static dispatch_item_t *takeLocked(dispatcher_t *d) {
+    for (int q = 0; q < DISPATCH_QUEUES; q++) {
+        dispatch_queue_t *queue = &d->queues[q];
+        dispatch_item_t *item = queue->head;
+        if (item == NULL)
+            continue;
+        queue->head = item->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+        return item;
+    }
+    return NULL;
+}
+
+static void *solverMain(void *args) {
+    dispatcher_t *d = (dispatcher_t *)args;
+    sync_mutex_lock(&d->mutex);
+    while (1) {
+        dispatch_item_t *item = takeLocked(d);
+        if (item == NULL) {
+            if (d->stop)
+                break;
+            sync_cond_wait(&d->work_condition, &d->mutex);
+            continue;
+        }
+        sync_mutex_unlock(&d->mutex);
+        item->solve(item);
+        sync_mutex_lock(&d->mutex);
+    }
+    sync_mutex_unlock(&d->mutex);
+    return NULL;
+}
+
+/*
+ * Function: dispatcher_submit
+ * --------------------------
+ * Queues item on item->queue and wakes a solver. The item must not be
+ * submitted again before its solve function has been called.
+ * */
+void dispatcher_submit(dispatcher_t *d, dispatch_item_t *item) {
+    dispatch_queue_t *queue = &d->queues[item->queue];
+    item->next = NULL;
+    sync_mutex_lock(&d->mutex);
+    if (queue->tail != NULL)
+        queue->tail->next = item;
+    else
+        queue->head = item;
+    queue->tail = item;
+    sync_cond_signal(&d->work_condition);
+    sync_mutex_unlock(&d->mutex);
+}
+
+/*
+ * Function: dispatcher_init
+ * --------------------------
+ * Starts solvers solver threads, or with ex, solver fibers on ex.
+ *
+ * returns: 0 on success, -1 otherwise.
+ * */
+int dispatcher_init(dispatcher_t *d, int solvers, executor_t *ex) {
+    memset(d, 0, sizeof(*d));
+    d->solvers = solvers;
+    sync_mutex_init(&d->mutex, ex != NULL);
+    sync_cond_init(&d->work_condition, ex != NULL);
+    if (ex != NULL) {
+        d->fibers = calloc(solvers, sizeof(fiber_t));
+        d->stacks = malloc((size_t)solvers * DISPATCH_STACK_SIZE);
+        if (d->fibers == NULL || d->stacks == NULL)
+            return -1;
+        for (int i = 0; i < solvers; i++)
+            fiber_start(&d->fibers[i], ex, solverMain, d, d->stacks + (size_t)i * DISPATCH_STACK_SIZE,
+                        DISPATCH_STACK_SIZE);
+        return 0;
+    }
+    d->threads = calloc(solvers, sizeof(pthread_t));
+    if (d->threads == NULL)
+        return -1;
+    for (int i = 0; i < solvers; i++) {
+        int rc = pthread_create(&d->threads[i], NULL, solverMain, d);
+        if (rc) {
+            errno = rc;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function: dispatcher_destroy
+ * --------------------------
+ * Lets the solvers drain the queues, then stops and joins them. Must
+ * not be called from a fiber.
+ * */
+void dispatcher_destroy(dispatcher_t *d) {
+    sync_mutex_lock(&d->mutex);
+    d->stop = 1;
+    sync_cond_broadcast(&d->work_condition);
+    sync_mutex_unlock(&d->mutex);
+    for (int i = 0; i < d->solvers; i++) {
+        if (d->fibers != NULL)
+            fiber_join(&d->fibers[i]);
+        else
+            pthread_join(d->threads[i], NULL);
+    }
+    sync_cond_destroy(&d->work_condition);
+    sync_mutex_destroy(&d->mutex);
+    free(d->threads);
+    free(d->fibers);
+    free(d->stacks);
+}
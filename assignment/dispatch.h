@@ -0,0 +1,53 @@
+#ifndef ASSIGNMENT_DISPATCH_H
+#define ASSIGNMENT_DISPATCH_H
+
+#include <pthread.h>
+
+#include "sync.h"
+
+#define DISPATCH_QUEUES 3 // One per problem type.
+#define DISPATCH_STACK_SIZE (64 * 1024) // Stack of each solver fiber.
+
+typedef struct dispatch_item dispatch_item_t;
+typedef void (*dispatch_fn)(dispatch_item_t *item);
+
+/*
+ * One reported problem. A wheel has at most one problem outstanding, so
+ * items are embedded per wheel and submitting never allocates.
+ */
+struct dispatch_item {
+    dispatch_item_t *next;
+    dispatch_fn solve; // Called on a solver thread.
+    void *arg;
+    int wheel;
+    int problem;
+    int queue; // Lower queues are served first.
+};
+
+typedef struct dispatch_queue {
+    dispatch_item_t *head;
+    dispatch_item_t *tail;
+} dispatch_queue_t;
+
+/*
+ * Fixed pool of solvers shared by every scenario: threads, or fibers on
+ * an executor so that solving stays on its workers. Items wait in
+ * per-type FIFO queues; a free solver takes the oldest item of the
+ * lowest-numbered non-empty queue.
+ */
+typedef struct dispatcher {
+    int solvers;
+    pthread_t *threads; // NULL with fibers.
+    fiber_t *fibers;    // NULL with threads.
+    char *stacks;
+    sync_mutex_t mutex; // Guards the queues and stop.
+    sync_cond_t work_condition;
+    dispatch_queue_t queues[DISPATCH_QUEUES];
+    int stop;
+} dispatcher_t;
+
+int dispatcher_init(dispatcher_t *d, int solvers, executor_t *ex);
+void dispatcher_submit(dispatcher_t *d, dispatch_item_t *item);
+void dispatcher_destroy(dispatcher_t *d);
+
+#endif //ASSIGNMENT_DISPATCH_H
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "executor.h"
+
+typedef struct executor_worker {
+    executor_t *ex;
+    int id;
+} executor_worker_t;
+
+// Worker the calling thread is, NULL on other threads.
+static _Thread_local executor_worker_t *self;
+
+static uint64_t monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static executor_array_t *arrayNew(int64_t capacity) {
+    executor_array_t *a = malloc(sizeof(executor_array_t) + capacity * sizeof(executor_task_t *));
+    if (a == NULL)
+        return NULL;
+    a->mask = capacity - 1;
+    a->prev = NULL;
+    return a;
+}
+
+static int dequeInit(executor_deque_t *d) {
+    executor_array_t *a = arrayNew(EXECUTOR_DEQUE_CAPACITY);
+    if (a == NULL)
+        return -1;
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->array, a);
+    return 0;
+}
+
+static void dequeFree(executor_deque_t *d) {
+    executor_array_t *a = atomic_load(&d->array);
+    while (a != NULL) {
+        executor_array_t *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+}
+
+// Owner only. Doubles the buffer; thieves may still read the old one.
+static executor_array_t *dequeGrow(executor_deque_t *d, executor_array_t *a, int64_t top, int64_t bottom) {
+    executor_array_t *grown = arrayNew((a->mask + 1) * 2);
+    if (grown == NULL) {
+        perror("Error growing executor deque");
+        exit(-1);
+    }
+    for (int64_t i = top; i < bottom; i++) {
+        atomic_store_explicit(&grown->tasks[i & grown->mask],
+                              atomic_load_explicit(&a->tasks[i & a->mask], memory_order_relaxed),
+                              memory_order_relaxed);
+    }
+    grown->prev = a;
+    atomic_store_explicit(&d->array, grown, memory_order_release);
+    return grown;
+}
+
+// Owner only.
+static void dequePush(executor_deque_t *d, executor_task_t *task) {
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    executor_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+    if (b - t > a->mask)
+        a = dequeGrow(d, a, t, b);
+    atomic_store_explicit(&a->tasks[b & a->mask], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+// Owner only, newest first.
+static executor_task_t *dequeTake(executor_deque_t *d) {
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    executor_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    executor_task_t *task = atomic_load_explicit(&a->tasks[b & a->mask], memory_order_relaxed);
+    if (t == b) {
+        // Last task: race thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            task = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+// Any thread, oldest first. NULL if empty or another thief won.
+static executor_task_t *dequeSteal(executor_deque_t *d) {
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b)
+        return NULL;
+    executor_array_t *a = atomic_load_explicit(&d->array, memory_order_acquire);
+    executor_task_t *task = atomic_load_explicit(&a->tasks[t & a->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return task;
+}
+
+// Tries every other worker's deque once, starting after id.
+static executor_task_t *stealAny(executor_t *ex, int id) {
+    for (int i = 1; i < ex->workers; i++) {
+        executor_task_t *task = dequeSteal(&ex->deques[(id + i) % ex->workers]);
+        if (task != NULL)
+            return task;
+    }
+    return NULL;
+}
+
+// Called with the mutex held.
+static void injectLocked(executor_t *ex, executor_task_t *task) {
+    task->next = NULL;
+    if (ex->injectTail != NULL)
+        ex->injectTail->next = task;
+    else
+        ex->injectHead = task;
+    ex->injectTail = task;
+    atomic_fetch_add(&ex->injected, 1);
+}
+
+// Called with the mutex held.
+static executor_task_t *popInjectedLocked(executor_t *ex) {
+    executor_task_t *task = ex->injectHead;
+    if (task == NULL)
+        return NULL;
+    ex->injectHead = task->next;
+    if (ex->injectHead == NULL)
+        ex->injectTail = NULL;
+    atomic_fetch_sub(&ex->injected, 1);
+    return task;
+}
+
+// Moves due timers to the injection queue. Called with the mutex held.
+static void fireTimersLocked(executor_t *ex, uint64_t now) {
+    int fired = 0;
+    while (ex->timers != NULL && ex->timers->due <= now) {
+        executor_task_t *task = ex->timers;
+        ex->timers = task->next;
+        injectLocked(ex, task);
+        fired++;
+    }
+    atomic_store(&ex->nextDue, ex->timers != NULL ? ex->timers->due : UINT64_MAX);
+    if (fired > 0)
+        pthread_cond_broadcast(&ex->work_condition);
+}
+
+static void fireTimers(executor_t *ex) {
+    uint64_t now = monotonicNow();
+    if (atomic_load_explicit(&ex->nextDue, memory_order_relaxed) > now)
+        return;
+    pthread_mutex_lock(&ex->mutex);
+    fireTimersLocked(ex, now);
+    pthread_mutex_unlock(&ex->mutex);
+}
+
+/*
+ * Sleeps until there may be work. Returns a task if one turned up while
+ * getting ready to sleep, NULL otherwise (including on stop).
+ * A submitter publishes its task before reading sleepers and we bump
+ * sleepers before the last scan, so one of the two always sees the other.
+ * */
+static executor_task_t *idleWait(executor_t *ex, int id) {
+    pthread_mutex_lock(&ex->mutex);
+    fireTimersLocked(ex, monotonicNow());
+    executor_task_t *task = popInjectedLocked(ex);
+    if (task == NULL) {
+        atomic_fetch_add(&ex->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        task = stealAny(ex, id);
+        if (task == NULL && !atomic_load(&ex->stop)) {
+            uint64_t due = atomic_load(&ex->nextDue);
+            if (due == UINT64_MAX) {
+                pthread_cond_wait(&ex->work_condition, &ex->mutex);
+            }
+            else {
+                struct timespec ts;
+                ts.tv_sec = (time_t)(due / 1000000000ull);
+                ts.tv_nsec = (long)(due % 1000000000ull);
+                pthread_cond_timedwait(&ex->work_condition, &ex->mutex, &ts);
+            }
+        }
+        atomic_fetch_sub(&ex->sleepers, 1);
+    }
+    pthread_mutex_unlock(&ex->mutex);
+    return task;
+}
+
+static void *workerMain(void *args) {
+    executor_worker_t *worker = (executor_worker_t *)args;
+    executor_t *ex = worker->ex;
+    int id = worker->id;
+    executor_deque_t *own = &ex->deques[id];
+    unsigned int ran = 0;
+    self = worker;
+
+    while (!atomic_load_explicit(&ex->stop, memory_order_relaxed)) {
+        executor_task_t *task = dequeTake(own);
+        if (task == NULL && atomic_load_explicit(&ex->injected, memory_order_relaxed) > 0) {
+            pthread_mutex_lock(&ex->mutex);
+            task = popInjectedLocked(ex);
+            pthread_mutex_unlock(&ex->mutex);
+        }
+        if (task == NULL)
+            task = stealAny(ex, id);
+        if (task == NULL)
+            task = idleWait(ex, id);
+        if (task == NULL)
+            continue;
+        task->fn(task);
+        if (++ran % EXECUTOR_TIMER_CHECK == 0)
+            fireTimers(ex);
+    }
+    free(worker);
+    return NULL;
+}
+
+// Wakes a sleeping worker if there is one.
+static void wakeOne(executor_t *ex) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ex->sleepers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&ex->mutex);
+        pthread_cond_signal(&ex->work_condition);
+        pthread_mutex_unlock(&ex->mutex);
+    }
+}
+
+/*
+ * Function: executor_submit
+ * --------------------------
+ * Queues task to run once on some worker. From a worker of ex this is a
+ * lock-free push onto its own deque.
+ * */
+void executor_submit(executor_t *ex, executor_task_t *task) {
+    if (self != NULL && self->ex == ex) {
+        dequePush(&ex->deques[self->id], task);
+        wakeOne(ex);
+        return;
+    }
+    pthread_mutex_lock(&ex->mutex);
+    injectLocked(ex, task);
+    pthread_cond_signal(&ex->work_condition);
+    pthread_mutex_unlock(&ex->mutex);
+}
+
+/*
+ * Function: executor_submit_after
+ * --------------------------
+ * Queues task to run no earlier than delayNs from now. Timers are
+ * checked by idle workers and every EXECUTOR_TIMER_CHECK tasks.
+ * */
+void executor_submit_after(executor_t *ex, executor_task_t *task, uint64_t delayNs) {
+    task->due = monotonicNow() + delayNs;
+    pthread_mutex_lock(&ex->mutex);
+    executor_task_t **link = &ex->timers;
+    while (*link != NULL && (*link)->due <= task->due)
+        link = &(*link)->next;
+    task->next = *link;
+    *link = task;
+    if (ex->timers == task) {
+        atomic_store(&ex->nextDue, task->due);
+        // Sleepers may be waiting for a later deadline.
+        pthread_cond_broadcast(&ex->work_condition);
+    }
+    pthread_mutex_unlock(&ex->mutex);
+}
+
+/*
+ * Function: executor_init
+ * --------------------------
+ * Starts workers worker threads.
+ *
+ * returns: 0 on success, -1 otherwise.
+ * */
+int executor_init(executor_t *ex, int workers) {
+    memset(ex, 0, sizeof(*ex));
+    ex->workers = workers;
+    ex->threads = calloc(workers, sizeof(pthread_t));
+    ex->deques = calloc(workers, sizeof(executor_deque_t));
+    if (ex->threads == NULL || ex->deques == NULL)
+        return -1;
+    for (int i = 0; i < workers; i++) {
+        if (dequeInit(&ex->deques[i]) != 0)
+            return -1;
+    }
+    pthread_mutex_init(&ex->mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ex->work_condition, &attr);
+    pthread_condattr_destroy(&attr);
+    atomic_init(&ex->nextDue, UINT64_MAX);
+    atomic_init(&ex->injected, 0);
+    atomic_init(&ex->sleepers, 0);
+    atomic_init(&ex->stop, 0);
+
+    for (int i = 0; i < workers; i++) {
+        executor_worker_t *worker = malloc(sizeof(executor_worker_t));
+        if (worker == NULL)
+            return -1;
+        worker->ex = ex;
+        worker->id = i;
+        int rc = pthread_create(&ex->threads[i], NULL, workerMain, worker);
+        if (rc) {
+            errno = rc;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function: executor_destroy
+ * --------------------------
+ * Stops and joins the workers. Tasks still queued are not run, so only
+ * call this once everything submitted has finished.
+ * */
+void executor_destroy(executor_t *ex) {
+    pthread_mutex_lock(&ex->mutex);
+    atomic_store(&ex->stop, 1);
+    pthread_cond_broadcast(&ex->work_condition);
+    pthread_mutex_unlock(&ex->mutex);
+    for (int i = 0; i < ex->workers; i++)
+        pthread_join(ex->threads[i], NULL);
+    for (int i = 0; i < ex->workers; i++)
+        dequeFree(&ex->deques[i]);
+    pthread_cond_destroy(&ex->work_condition);
+    pthread_mutex_destroy(&ex->mutex);
+    free(ex->threads);
+    free(ex->deques);
+}
+
+// One worker per online core.
+int executor_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
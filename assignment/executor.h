@@ -0,0 +1,69 @@
+#ifndef ASSIGNMENT_EXECUTOR_H
+#define ASSIGNMENT_EXECUTOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define EXECUTOR_DEQUE_CAPACITY 256 // Initial per-worker deque size, doubled when full.
+#define EXECUTOR_TIMER_CHECK 64 // Tasks a busy worker runs between due-timer checks.
+
+typedef struct executor_task executor_task_t;
+typedef void (*executor_fn)(executor_task_t *task);
+
+/*
+ * Unit of work. Tasks are embedded in the object they work on, so
+ * submitting never allocates. A task may be submitted again once it
+ * has started running; the executor does not touch it after calling fn.
+ */
+struct executor_task {
+    executor_fn fn;
+    void *arg;
+    uint64_t due;          // Timer tasks: CLOCK_MONOTONIC ns.
+    executor_task_t *next; // Injection queue / timer list link.
+};
+
+// Chase-Lev buffer. Replaced buffers are kept until the deque is freed.
+typedef struct executor_array {
+    int64_t mask;
+    struct executor_array *prev;
+    _Atomic(executor_task_t *) tasks[];
+} executor_array_t;
+
+/*
+ * Work-stealing deque (Chase-Lev). The owning worker pushes and takes
+ * at bottom, other workers steal from top.
+ */
+typedef struct executor_deque {
+    _Alignas(64) atomic_llong top;
+    _Alignas(64) atomic_llong bottom;
+    _Atomic(executor_array_t *) array;
+} executor_deque_t;
+
+/*
+ * Fixed pool of worker threads. Tasks submitted from a worker go to its
+ * own deque; tasks from other threads and due timers go through the
+ * injection queue. Idle workers steal, then sleep on work_condition.
+ */
+typedef struct executor {
+    int workers;
+    pthread_t *threads;
+    executor_deque_t *deques;
+    pthread_mutex_t mutex; // Guards the injection queue, timers and sleeping.
+    pthread_cond_t work_condition;
+    executor_task_t *injectHead;
+    executor_task_t *injectTail;
+    executor_task_t *timers; // Sorted by due.
+    atomic_ullong nextDue;   // due of the first timer, UINT64_MAX if none.
+    atomic_int injected;     // Tasks in the injection queue.
+    atomic_int sleepers;
+    atomic_int stop;
+} executor_t;
+
+int executor_init(executor_t *ex, int workers);
+void executor_submit(executor_t *ex, executor_task_t *task);
+void executor_submit_after(executor_t *ex, executor_task_t *task, uint64_t delayNs);
+void executor_destroy(executor_t *ex);
+int executor_default_workers(void);
+
+#endif //ASSIGNMENT_EXECUTOR_H
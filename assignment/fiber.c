@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "fiber.h"
+
+#define SPIN_BEFORE_YIELD 100
+
+// Fiber the calling worker is running, NULL elsewhere.
+static _Thread_local fiber_t *current;
+
+void fiberStart(fiber_t *f);
+
+#if defined(__x86_64__)
+/*
+ * contextSwitch(from, to): pushes the callee-saved registers and the
+ * SSE/x87 control words, stores rsp in from->sp, then restores to.
+ * A new fiber's stack is laid out so that the first switch "returns"
+ * into fiberTrampoline with the fiber in r12.
+ */
+void contextSwitch(fiber_context_t *from, fiber_context_t *to);
+void fiberTrampoline(void);
+__asm__(
+        ".text\n"
+        ".globl contextSwitch\n"
+        ".hidden contextSwitch\n"
+        ".type contextSwitch, @function\n"
+        "contextSwitch:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq (%rsi), %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size contextSwitch, .-contextSwitch\n"
+        ".globl fiberTrampoline\n"
+        ".hidden fiberTrampoline\n"
+        ".type fiberTrampoline, @function\n"
+        "fiberTrampoline:\n"
+        "    movq %r12, %rdi\n"
+        "    call fiberStart\n"
+        "    ud2\n"
+        ".size fiberTrampoline, .-fiberTrampoline\n");
+
+static void contextInit(fiber_t *f, void *stack, size_t stackSize) {
+    uintptr_t top = ((uintptr_t)stack + stackSize - 16) & ~(uintptr_t)15;
+    uint64_t *sp = (uint64_t *)top;
+    *--sp = (uint64_t)(uintptr_t)fiberTrampoline; // Popped by ret, leaving rsp 16-byte aligned.
+    *--sp = 0;                          // rbp
+    *--sp = 0;                          // rbx
+    *--sp = (uint64_t)(uintptr_t)f;     // r12
+    *--sp = 0;                          // r13
+    *--sp = 0;                          // r14
+    *--sp = 0;                          // r15
+    *--sp = 0x1F80ull | (0x037Full << 32); // Default MXCSR and x87 control word.
+    f->ctx.sp = sp;
+}
+
+#else
+static void contextSwitch(fiber_context_t *from, fiber_context_t *to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+// makecontext only passes ints, so the fiber pointer is split in two.
+static void fiberTrampolineUc(unsigned int hi, unsigned int lo) {
+    fiberStart((fiber_t *)(((uintptr_t)hi << 32) | (uintptr_t)lo));
+}
+
+static void contextInit(fiber_t *f, void *stack, size_t stackSize) {
+    getcontext(&f->ctx.uc);
+    f->ctx.uc.uc_stack.ss_sp = stack;
+    f->ctx.uc.uc_stack.ss_size = stackSize;
+    f->ctx.uc.uc_link = NULL;
+    uintptr_t p = (uintptr_t)f;
+    makecontext(&f->ctx.uc, (void (*)(void))fiberTrampolineUc, 2,
+                (unsigned int)(p >> 32), (unsigned int)(p & 0xFFFFFFFFu));
+}
+#endif
+
+static void futex_wait(atomic_uint *addr, unsigned int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static void spinLock(atomic_flag *lock) {
+    int spins = 0;
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+        if (++spins == SPIN_BEFORE_YIELD) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
+
+static void spinUnlock(atomic_flag *lock) {
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+// Entry point on the fiber's own stack. Never returns.
+void fiberStart(fiber_t *f) {
+    f->fn(f->arg);
+    f->finished = 1;
+    contextSwitch(&f->ctx, f->returnCtx);
+    abort();
+}
+
+/*
+ * Task that runs the fiber until it switches out, then carries out what
+ * it asked for on the way out. Doing that here, off the fiber's stack,
+ * is what lets a fiber park while holding a spin lock: nobody can
+ * resume it before the lock is released.
+ * */
+static void fiberResumeTask(executor_task_t *task) {
+    fiber_t *f = (fiber_t *)task->arg;
+    fiber_context_t here;
+    f->returnCtx = &here;
+    current = f;
+    contextSwitch(&here, &f->ctx);
+    current = NULL;
+
+    atomic_flag *release = f->release;
+    uint64_t sleepNs = f->sleepNs;
+    f->release = NULL;
+    f->sleepNs = 0;
+    if (f->finished) {
+        atomic_store(&f->done, 1);
+        futex_wake(&f->done, INT_MAX);
+    }
+    else if (sleepNs > 0) {
+        executor_submit_after(f->ex, &f->task, sleepNs);
+    }
+    else if (release != NULL) {
+        spinUnlock(release);
+    }
+}
+
+/*
+ * Function: fiber_start
+ * --------------------------
+ * Runs fn(arg) as a fiber on ex, using stack. The fiber must have
+ * finished (see fiber_join) before f or its stack are reused.
+ * */
+void fiber_start(fiber_t *f, executor_t *ex, void *(*fn)(void *), void *arg, void *stack, size_t stackSize) {
+    memset(f, 0, sizeof(*f));
+    f->task.fn = fiberResumeTask;
+    f->task.arg = f;
+    f->ex = ex;
+    f->fn = fn;
+    f->arg = arg;
+    atomic_init(&f->done, 0);
+    contextInit(f, stack, stackSize);
+    executor_submit(ex, &f->task);
+}
+
+// Waits for f to finish. Only for plain threads, not fibers.
+void fiber_join(fiber_t *f) {
+    while (atomic_load(&f->done) == 0) {
+        futex_wait(&f->done, 0);
+    }
+}
+
+/*
+ * Not inlined: a fiber can resume on another worker, and a thread-local
+ * address computed before a switch would still point at the old one.
+ * */
+__attribute__((noinline)) fiber_t *fiber_current(void) {
+    return current;
+}
+
+// Switches out of the calling fiber; release is unlocked once it is off its stack.
+static void fiberPark(fiber_t *f, atomic_flag *release) {
+    f->release = release;
+    contextSwitch(&f->ctx, f->returnCtx);
+}
+
+// Suspends the calling fiber for at least ns without blocking its worker.
+void fiber_sleep(uint64_t ns) {
+    fiber_t *f = fiber_current();
+    f->sleepNs = ns > 0 ? ns : 1;
+    contextSwitch(&f->ctx, f->returnCtx);
+}
+
+// Blocks until waiterWake, unlocking lock (which queued w) on the way.
+static void waiterPark(fiber_waiter_t *w, atomic_flag *lock) {
+    if (w->fiber != NULL) {
+        fiberPark(w->fiber, lock);
+        return;
+    }
+    spinUnlock(lock);
+    while (atomic_load_explicit(&w->woken, memory_order_acquire) == 0) {
+        futex_wait(&w->woken, 0);
+    }
+}
+
+// w may be gone as soon as it is woken, so nothing touches it after.
+static void waiterWake(fiber_waiter_t *w) {
+    fiber_t *f = w->fiber;
+    if (f != NULL) {
+        executor_submit(f->ex, &f->task);
+        return;
+    }
+    atomic_uint *woken = &w->woken;
+    atomic_store_explicit(woken, 1, memory_order_release);
+    futex_wake(woken, 1);
+}
+
+static void waiterInit(fiber_waiter_t *w) {
+    w->next = NULL;
+    w->fiber = fiber_current();
+    atomic_init(&w->woken, 0);
+}
+
+void fiber_mutex_init(fiber_mutex_t *m) {
+    atomic_flag_clear(&m->lock);
+    m->locked = 0;
+    m->head = NULL;
+    m->tail = NULL;
+}
+
+/*
+ * Woken waiters compete for the mutex again rather than being handed it,
+ * so the owner is always running: a parked fiber never holds the mutex
+ * while a plain thread blocks its worker waiting for it.
+ * */
+void fiber_mutex_lock(fiber_mutex_t *m) {
+    while (1) {
+        spinLock(&m->lock);
+        if (!m->locked) {
+            m->locked = 1;
+            spinUnlock(&m->lock);
+            return;
+        }
+        fiber_waiter_t w;
+        waiterInit(&w);
+        if (m->tail != NULL)
+            m->tail->next = &w;
+        else
+            m->head = &w;
+        m->tail = &w;
+        waiterPark(&w, &m->lock);
+    }
+}
+
+// returns: 1 if m was free and is now held, 0 if it is held elsewhere.
+int fiber_mutex_trylock(fiber_mutex_t *m) {
+    spinLock(&m->lock);
+    int acquired = !m->locked;
+    m->locked = 1;
+    spinUnlock(&m->lock);
+    return acquired;
+}
+
+void fiber_mutex_unlock(fiber_mutex_t *m) {
+    spinLock(&m->lock);
+    fiber_waiter_t *w = m->head;
+    if (w != NULL) {
+        m->head = w->next;
+        if (m->head == NULL)
+            m->tail = NULL;
+    }
+    m->locked = 0;
+    spinUnlock(&m->lock);
+    if (w != NULL)
+        waiterWake(w);
+}
+
+void fiber_cond_init(fiber_cond_t *c) {
+    atomic_flag_clear(&c->lock);
+    c->head = NULL;
+    c->tail = NULL;
+}
+
+void fiber_cond_wait(fiber_cond_t *c, fiber_mutex_t *m) {
+    fiber_waiter_t w;
+    waiterInit(&w);
+    spinLock(&c->lock);
+    if (c->tail != NULL)
+        c->tail->next = &w;
+    else
+        c->head = &w;
+    c->tail = &w;
+    fiber_mutex_unlock(m);
+    waiterPark(&w, &c->lock);
+    fiber_mutex_lock(m);
+}
+
+void fiber_cond_signal(fiber_cond_t *c) {
+    spinLock(&c->lock);
+    fiber_waiter_t *w = c->head;
+    if (w != NULL) {
+        c->head = w->next;
+        if (c->head == NULL)
+            c->tail = NULL;
+    }
+    spinUnlock(&c->lock);
+    if (w != NULL)
+        waiterWake(w);
+}
+
+void fiber_cond_broadcast(fiber_cond_t *c) {
+    spinLock(&c->lock);
+    fiber_waiter_t *w = c->head;
+    c->head = NULL;
+    c->tail = NULL;
+    spinUnlock(&c->lock);
+    while (w != NULL) {
+        fiber_waiter_t *next = w->next;
+        waiterWake(w);
+        w = next;
+    }
+}
+
+void fiber_barrier_init(fiber_barrier_t *b, unsigned int count) {
+    atomic_flag_clear(&b->lock);
+    b->count = count;
+    b->arrived = 0;
+    b->head = NULL;
+}
+
+/*
+ * Function: fiber_barrier_wait
+ * --------------------------
+ * returns: PTHREAD_BARRIER_SERIAL_THREAD for the last to arrive, which
+ * releases the others, 0 for the rest.
+ * */
+int fiber_barrier_wait(fiber_barrier_t *b) {
+    spinLock(&b->lock);
+    if (++b->arrived == b->count) {
+        fiber_waiter_t *w = b->head;
+        b->head = NULL;
+        b->arrived = 0;
+        spinUnlock(&b->lock);
+        while (w != NULL) {
+            fiber_waiter_t *next = w->next;
+            waiterWake(w);
+            w = next;
+        }
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+    fiber_waiter_t w;
+    waiterInit(&w);
+    w.next = b->head;
+    b->head = &w;
+    waiterPark(&w, &b->lock);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef ASSIGNMENT_FIBER_H
+#define ASSIGNMENT_FIBER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "executor.h"
+
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+// Saved registers of a switched-out fiber or of the worker running one.
+typedef struct fiber_context {
+#if defined(__x86_64__)
+    void *sp; // Callee-saved registers are on the stack below sp.
+#else
+    ucontext_t uc;
+#endif
+} fiber_context_t;
+
+/*
+ * User-space thread. A fiber runs as a task on an executor: submitting
+ * fiber->task switches a worker onto the fiber's stack until it parks,
+ * sleeps or returns, so any number of fibers share the executor's workers.
+ * The stack is supplied by the caller and has no guard page.
+ */
+typedef struct fiber {
+    executor_task_t task; // Resumes the fiber.
+    executor_t *ex;
+    void *(*fn)(void *);
+    void *arg;
+    fiber_context_t ctx;
+    fiber_context_t *returnCtx; // Worker that resumed the fiber.
+    atomic_flag *release;       // Unlocked once the fiber has switched out.
+    uint64_t sleepNs;           // Resubmitted after this long once switched out.
+    int finished;
+    atomic_uint done;           // Set (and woken) once the worker is off the stack.
+} fiber_t;
+
+/*
+ * Blocked fiber or thread. Waiters live on the waiting stack and are
+ * linked into the primitive's queue while its spin lock is held.
+ */
+typedef struct fiber_waiter {
+    struct fiber_waiter *next;
+    fiber_t *fiber;    // NULL for a plain thread, which sleeps on woken.
+    atomic_uint woken;
+} fiber_waiter_t;
+
+/*
+ * Fiber-aware mutex, condition variable and barrier. Blocking parks the
+ * calling fiber instead of its worker; plain threads may use them too
+ * and sleep on a futex. Each guards its state with a short spin lock.
+ */
+typedef struct fiber_mutex {
+    atomic_flag lock;
+    int locked;
+    fiber_waiter_t *head;
+    fiber_waiter_t *tail;
+} fiber_mutex_t;
+
+typedef struct fiber_cond {
+    atomic_flag lock;
+    fiber_waiter_t *head;
+    fiber_waiter_t *tail;
+} fiber_cond_t;
+
+typedef struct fiber_barrier {
+    atomic_flag lock;
+    unsigned int count;
+    unsigned int arrived;
+    fiber_waiter_t *head;
+} fiber_barrier_t;
+
+void fiber_start(fiber_t *f, executor_t *ex, void *(*fn)(void *), void *arg, void *stack, size_t stackSize);
+void fiber_join(fiber_t *f);
+fiber_t *fiber_current(void);
+void fiber_sleep(uint64_t ns);
+
+void fiber_mutex_init(fiber_mutex_t *m);
+void fiber_mutex_lock(fiber_mutex_t *m);
+int fiber_mutex_trylock(fiber_mutex_t *m);
+void fiber_mutex_unlock(fiber_mutex_t *m);
+
+void fiber_cond_init(fiber_cond_t *c);
+void fiber_cond_wait(fiber_cond_t *c, fiber_mutex_t *m);
+void fiber_cond_signal(fiber_cond_t *c);
+void fiber_cond_broadcast(fiber_cond_t *c);
+
+void fiber_barrier_init(fiber_barrier_t *b, unsigned int count);
+int fiber_barrier_wait(fiber_barrier_t *b);
+
+#endif //ASSIGNMENT_FIBER_H
@@ -0,0 +1,73 @@
+#include <time.h>
+
+#include "hist.h"
+
+static int bucketOf(uint64_t ns) {
+    if (ns < HIST_SUB_COUNT)
+        return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS + 1;
+    return shift * HIST_HALF + (int)(ns >> shift);
+}
+
+// Largest value that falls in bucket.
+static uint64_t bucketTop(int bucket) {
+    if (bucket < HIST_SUB_COUNT)
+        return (uint64_t)bucket;
+    int shift = bucket / HIST_HALF - 1;
+    uint64_t sub = (uint64_t)(bucket - shift * HIST_HALF);
+    return ((sub + 1) << shift) - 1;
+}
+
+// CLOCK_MONOTONIC in ns.
+uint64_t hist_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void hist_reset(hist_t *h) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        atomic_init(&h->counts[i], 0);
+    atomic_init(&h->total, 0);
+    atomic_init(&h->max, 0);
+}
+
+void hist_record(hist_t *h, uint64_t ns) {
+    atomic_fetch_add_explicit(&h->counts[bucketOf(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak(&h->max, &max, ns));
+}
+
+/*
+ * Function: hist_percentile
+ * --------------------------
+ * Not to be called while values are still being recorded.
+ *
+ * returns: the top of the bucket holding the p-th fraction (0 to 1) of
+ * the values, capped at the largest value, or 0 if there are none.
+ * */
+uint64_t hist_percentile(hist_t *h, double p) {
+    uint64_t total = atomic_load(&h->total);
+    uint64_t max = atomic_load(&h->max);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * (double)total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load(&h->counts[i]);
+        if (seen >= rank)
+            return bucketTop(i) < max ? bucketTop(i) : max;
+    }
+    return max;
+}
+
+// One line: count, then p50, p99, p99.9 and max in microseconds.
+void hist_print(hist_t *h, const char *name, FILE *out) {
+    fprintf(out, "  %-10s n=%-8llu p50=%10.1fus p99=%10.1fus p999=%10.1fus max=%10.1fus\n", name,
+            (unsigned long long)atomic_load(&h->total), hist_percentile(h, 0.50) / 1e3,
+            hist_percentile(h, 0.99) / 1e3, hist_percentile(h, 0.999) / 1e3,
+            (double)atomic_load(&h->max) / 1e3);
+}
@@ -0,0 +1,30 @@
+#ifndef ASSIGNMENT_HIST_H
+#define ASSIGNMENT_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define HIST_SUB_BITS 6 // HIST_HALF = 32 linear buckets per power of two: values within ~3%.
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB_COUNT / 2)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_HALF + HIST_HALF)
+
+/*
+ * HDR-style latency histogram in ns: exact below HIST_SUB_COUNT, then
+ * HIST_HALF linear buckets per power of two, so the relative error is
+ * bounded at any magnitude. Recording is lock-free.
+ */
+typedef struct hist {
+    atomic_ullong counts[HIST_BUCKETS];
+    atomic_ullong total;
+    atomic_ullong max;
+} hist_t;
+
+uint64_t hist_now(void);
+void hist_reset(hist_t *h);
+void hist_record(hist_t *h, uint64_t ns);
+uint64_t hist_percentile(hist_t *h, double p);
+void hist_print(hist_t *h, const char *name, FILE *out);
+
+#endif //ASSIGNMENT_HIST_H
@@ -0,0 +1,799 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdarg.h>
+#include <sys/types.h>
+
+#include "log.h"
+
+// timeout is relative, NULL waits indefinitely.
+static void futex_wait(atomic_uint *addr, unsigned int val, const struct timespec *timeout) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static size_t roundUpPow2(size_t n) {
+    size_t p = 2;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+static int ringInit(log_ring_t *ring, size_t capacity, log_overflow policy) {
+    capacity = roundUpPow2(capacity);
+    ring->slots = malloc(capacity * sizeof(log_slot_t));
+    if (ring->slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring->slots[i].seq, i);
+    }
+    ring->mask = capacity - 1;
+    ring->policy = policy;
+    atomic_init(&ring->next_in, 0);
+    atomic_init(&ring->next_out, 0);
+    atomic_init(&ring->data_futex, 0);
+    atomic_init(&ring->consumerWaiting, 0);
+    atomic_init(&ring->space_futex, 0);
+    atomic_init(&ring->producersWaiting, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->overwritten, 0);
+    atomic_init(&ring->close, 0);
+    memset(&ring->stats, 0, sizeof(ring->stats));
+    return 0;
+}
+
+int log_init(shared_buffer_t *sb, char *fileName, const log_config_t *config) {
+    size_t consoleCapacity = config->capacity < LOG_MAX_CONSOLE_BACKLOG ? config->capacity : LOG_MAX_CONSOLE_BACKLOG;
+    if (ringInit(&sb->file, config->capacity, config->overflow) != 0) {
+        return -1;
+    }
+    if (ringInit(&sb->console, consoleCapacity, LOG_OVERFLOW_DROP_NEWEST) != 0) {
+        free(sb->file.slots);
+        return -1;
+    }
+    sb->clock = NULL;
+    sb->fileName = fileName;
+    sb->format = config->format;
+    sb->backend = config->backend;
+    sb->sync = config->sync;
+    sb->syncEvery = config->syncEvery;
+    sb->level = config->level;
+    sb->consoleMode = config->consoleMode;
+    sb->consoleRate = config->consoleRate;
+    return 0;
+}
+
+void log_destroy(shared_buffer_t *sb) {
+    free(sb->file.slots);
+    free(sb->console.slots);
+    sb->file.slots = NULL;
+    sb->console.slots = NULL;
+    return;
+}
+
+static void ringClose(log_ring_t *ring) {
+    atomic_store(&ring->close, 1);
+    atomic_fetch_add(&ring->data_futex, 1);
+    futex_wake(&ring->data_futex, 1);
+}
+
+/*
+ * Function: log_close
+ * --------------------------
+ * Tells both consumers to drain whatever is left in their ring and exit.
+ * */
+void log_close(shared_buffer_t *sb) {
+    ringClose(&sb->file);
+    ringClose(&sb->console);
+}
+
+/*
+ * Overwrite-oldest: discards the entry at position oldest if it is still
+ * published and unclaimed. Takes it through the same CAS on next_out the
+ * consumer uses, so an entry is either discarded or logged, never both.
+ * */
+static int discardOldest(log_ring_t *ring, size_t oldest) {
+    log_slot_t *slot = &ring->slots[oldest & ring->mask];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != oldest + 1)
+        return 0;
+    size_t expected = oldest;
+    if (!atomic_compare_exchange_strong(&ring->next_out, &expected, oldest + 1))
+        return 0;
+    atomic_store_explicit(&slot->seq, oldest + ring->mask + 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->overwritten, 1, memory_order_relaxed);
+    return 1;
+}
+
+/*
+ * Claims the next free ring slot for the caller.
+ * What happens when the ring is full depends on the ring's policy:
+ * LOG_OVERFLOW_BLOCK waits on a futex (never a mutex), DROP_NEWEST returns
+ * NULL and counts the entry as dropped, OVERWRITE_OLDEST discards the oldest
+ * unclaimed entry and retries (dropping the new one if the consumer already
+ * has the oldest in flight).
+ * */
+static log_slot_t *claimSlot(log_ring_t *ring, size_t *posOut) {
+    size_t pos = atomic_load_explicit(&ring->next_in, memory_order_relaxed);
+    log_slot_t *slot;
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->next_in, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+            continue;
+        }
+        if (diff > 0) {
+            pos = atomic_load_explicit(&ring->next_in, memory_order_relaxed);
+            continue;
+        }
+
+        // Ring is full.
+        switch (ring->policy) {
+            case LOG_OVERFLOW_OVERWRITE_OLDEST:
+                if (discardOldest(ring, pos - ring->mask - 1)
+                    || atomic_load(&ring->next_out) > pos - ring->mask - 1) {
+                    // Either we made room or somebody else is; look again.
+                    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+                        pos = atomic_load_explicit(&ring->next_in, memory_order_relaxed);
+                        continue;
+                    }
+                }
+                // Oldest entry is already being written by the consumer.
+                atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+                return NULL;
+            case LOG_OVERFLOW_DROP_NEWEST:
+                atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+                return NULL;
+            case LOG_OVERFLOW_BLOCK:
+            default: {
+                // Wait for the consumer to free a slot.
+                unsigned int v = atomic_load(&ring->space_futex);
+                atomic_fetch_add(&ring->producersWaiting, 1);
+                if (atomic_load(&slot->seq) == seq)
+                    futex_wait(&ring->space_futex, v, NULL);
+                atomic_fetch_sub(&ring->producersWaiting, 1);
+                pos = atomic_load_explicit(&ring->next_in, memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    *posOut = pos;
+    return slot;
+}
+
+// Hands a filled slot to the consumer, waking it if it is asleep.
+static void publishSlot(log_ring_t *ring, log_slot_t *slot, size_t pos) {
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->consumerWaiting, memory_order_relaxed)) {
+        atomic_fetch_add(&ring->data_futex, 1);
+        futex_wake(&ring->data_futex, 1);
+    }
+}
+
+// Console summary mode keeps the per-cycle distance, completion and warnings.
+static int consoleWants(shared_buffer_t *sb, log_event_id event, log_level level) {
+    switch (sb->consoleMode) {
+        case LOG_CONSOLE_FULL:
+            return 1;
+        case LOG_CONSOLE_SUMMARY:
+            return event == EV_DISTANCE || event == EV_SCENARIO_COMPLETED || level >= LOG_WARN;
+        default:
+            return 0;
+    }
+}
+
+// Copies an entry into the console ring, dropping it if the console is behind.
+static void copyToConsole(shared_buffer_t *sb, const log_entry_t *entry, size_t textLen) {
+    size_t pos;
+    log_slot_t *slot = claimSlot(&sb->console, &pos);
+    if (slot == NULL)
+        return;
+    slot->entry.rec = entry->rec;
+    slot->entry.fmt = entry->fmt;
+    slot->entry.nargs = entry->nargs;
+    memcpy(slot->entry.argTypes, entry->argTypes, entry->nargs);
+    memcpy(slot->entry.args, entry->args, entry->nargs * sizeof(log_arg_t));
+    // A clamped string ends at text[textLen], one past the arena log_printf reports.
+    if (textLen > 0)
+        memcpy(slot->entry.text, entry->text, textLen + 1);
+    publishSlot(&sb->console, slot, pos);
+}
+
+static uint64_t monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Timestamp for a record: simulated time if the scenario provides it.
+static uint64_t recordTime(shared_buffer_t *sb) {
+    if (sb->clock != NULL)
+        return atomic_load_explicit(sb->clock, memory_order_relaxed);
+    return monotonicNow();
+}
+
+/*
+ * Function: log_event
+ * --------------------------
+ * Records a structured event. No formatting happens here,
+ * the logger threads render (text mode) or write (binary mode) the record.
+ * */
+void log_event(shared_buffer_t *sb, log_event_id event, int wheel, log_handler handler,
+               unsigned int cycle, double value) {
+    size_t pos;
+    log_slot_t *slot = claimSlot(&sb->file, &pos);
+    if (slot == NULL)
+        return;
+    log_record_t *rec = &slot->entry.rec;
+    rec->timestamp = recordTime(sb);
+    rec->value = value;
+    rec->cycle = cycle;
+    rec->wheel = (uint16_t)wheel;
+    rec->event = (uint8_t)event;
+    rec->handler = (uint8_t)handler;
+    slot->entry.nargs = 0; // Slots are reused, and only EV_TEXT entries carry arguments.
+    if (consoleWants(sb, event, log_event_level(event)))
+        copyToConsole(sb, &slot->entry, 0);
+    publishSlot(&sb->file, slot, pos);
+}
+
+// Skips flags, width, precision and length of the spec after '%', returns its conversion character.
+static const char *parseSpec(const char *p, log_arg_type *width, int *stars) {
+    *stars = 0;
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    *width = ARG_INT;
+    switch (*p) {
+        case 'h':
+            p += p[1] == 'h' ? 2 : 1;
+            break;
+        case 'l':
+            if (p[1] == 'l') {
+                *width = ARG_LLONG;
+                p += 2;
+            }
+            else {
+                *width = ARG_LONG;
+                p++;
+            }
+            break;
+        case 'z':
+            *width = ARG_SIZE;
+            p++;
+            break;
+        case 'j':
+            *width = ARG_INTMAX;
+            p++;
+            break;
+        case 't':
+            *width = ARG_PTRDIFF;
+            p++;
+            break;
+        case 'L':
+            *width = ARG_LDOUBLE;
+            p++;
+            break;
+    }
+    return p;
+}
+
+/*
+ * Function: log_printf
+ * --------------------------
+ * Deferred printf. Only the format pointer and the raw arguments are
+ * stored, the logger thread does the formatting.
+ * fmt must outlive the scenario (a string literal), %s arguments are
+ * copied so they may point at caller buffers. Arguments beyond
+ * LOG_MAX_ARGS and %n are not supported.
+ * */
+void log_printf(shared_buffer_t *sb, log_level level, const char *fmt, ...) {
+    size_t pos;
+    log_slot_t *slot = claimSlot(&sb->file, &pos);
+    if (slot == NULL)
+        return;
+    log_entry_t *entry = &slot->entry;
+    size_t arena = 0;
+    int nargs = 0;
+    va_list ap;
+    va_start(ap, fmt);
+    for (const char *p = fmt; *p && nargs < LOG_MAX_ARGS; p++) {
+        if (*p != '%')
+            continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        log_arg_type width;
+        int stars;
+        p = parseSpec(p + 1, &width, &stars);
+        while (stars-- > 0 && nargs < LOG_MAX_ARGS) {
+            entry->argTypes[nargs] = ARG_INT;
+            entry->args[nargs++].i = va_arg(ap, int);
+        }
+        if (nargs == LOG_MAX_ARGS || *p == '\0')
+            break;
+        log_arg_t *arg = &entry->args[nargs];
+        switch (*p) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                // Same-width signed va_arg is valid for the unsigned conversions too.
+                switch (width) {
+                    case ARG_LONG: arg->i = va_arg(ap, long); break;
+                    case ARG_LLONG: arg->i = va_arg(ap, long long); break;
+                    case ARG_SIZE: arg->i = va_arg(ap, ssize_t); break;
+                    case ARG_INTMAX: arg->i = va_arg(ap, intmax_t); break;
+                    case ARG_PTRDIFF: arg->i = va_arg(ap, ptrdiff_t); break;
+                    default: width = ARG_INT; arg->i = va_arg(ap, int); break;
+                }
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (width == ARG_LDOUBLE) {
+                    arg->d = (double)va_arg(ap, long double);
+                }
+                else {
+                    width = ARG_DOUBLE;
+                    arg->d = va_arg(ap, double);
+                }
+                break;
+            case 's': {
+                const char *str = va_arg(ap, const char *);
+                size_t len = str != NULL ? strlen(str) : 0;
+                if (len > BUFF_W - 1 - arena)
+                    len = BUFF_W - 1 - arena;
+                memcpy(entry->text + arena, str, len);
+                entry->text[arena + len] = '\0';
+                arg->i = (long long)arena;
+                arena += len + 1;
+                if (arena > BUFF_W - 1)
+                    arena = BUFF_W - 1;
+                width = ARG_STRING;
+                break;
+            }
+            case 'p':
+                arg->p = va_arg(ap, void *);
+                width = ARG_POINTER;
+                break;
+            default:
+                continue;
+        }
+        entry->argTypes[nargs++] = (unsigned char)width;
+    }
+    va_end(ap);
+
+    entry->fmt = fmt;
+    entry->nargs = (unsigned char)nargs;
+    entry->rec.timestamp = recordTime(sb);
+    entry->rec.value = 0;
+    entry->rec.cycle = 0;
+    entry->rec.wheel = LOG_NO_WHEEL;
+    entry->rec.event = EV_TEXT;
+    entry->rec.handler = HANDLER_NONE;
+    if (consoleWants(sb, EV_TEXT, level))
+        copyToConsole(sb, entry, arena);
+    publishSlot(&sb->file, slot, pos);
+}
+
+// Renders a log_printf entry one conversion at a time, consumer side.
+static int formatDeferred(const log_entry_t *entry, char *buf, size_t len) {
+    size_t out = 0;
+    int argi = 0;
+    char spec[32];
+    const char *p = entry->fmt;
+    while (*p && out < len - 1) {
+        if (*p != '%' || p[1] == '%') {
+            buf[out++] = *p;
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+        log_arg_type width;
+        int stars;
+        const char *end = parseSpec(p + 1, &width, &stars);
+        if (*end == '\0' || argi + stars >= entry->nargs || end - p + 1 >= (long)sizeof(spec) - 16) {
+            break;
+        }
+        // Substitute captured '*' widths/precisions into the spec.
+        size_t si = 0;
+        for (const char *q = p; q <= end; q++) {
+            if (*q == '*')
+                si += snprintf(spec + si, sizeof(spec) - si, "%d", (int)entry->args[argi++].i);
+            else
+                spec[si++] = *q;
+        }
+        spec[si] = '\0';
+        const log_arg_t *arg = &entry->args[argi];
+        size_t rem = len - out;
+        int n;
+        switch ((log_arg_type)entry->argTypes[argi]) {
+            case ARG_LONG: n = snprintf(buf + out, rem, spec, (long)arg->i); break;
+            case ARG_LLONG: n = snprintf(buf + out, rem, spec, arg->i); break;
+            case ARG_SIZE: n = snprintf(buf + out, rem, spec, (ssize_t)arg->i); break;
+            case ARG_INTMAX: n = snprintf(buf + out, rem, spec, (intmax_t)arg->i); break;
+            case ARG_PTRDIFF: n = snprintf(buf + out, rem, spec, (ptrdiff_t)arg->i); break;
+            case ARG_DOUBLE: n = snprintf(buf + out, rem, spec, arg->d); break;
+            case ARG_LDOUBLE: n = snprintf(buf + out, rem, spec, (long double)arg->d); break;
+            case ARG_STRING: n = snprintf(buf + out, rem, spec, entry->text + arg->i); break;
+            case ARG_POINTER: n = snprintf(buf + out, rem, spec, arg->p); break;
+            case ARG_INT:
+            default: n = snprintf(buf + out, rem, spec, (int)arg->i); break;
+        }
+        argi++;
+        if (n < 0)
+            break;
+        out += (size_t)n < rem ? (size_t)n : rem - 1;
+        p = end + 1;
+    }
+    buf[out] = '\0';
+    return (int)out;
+}
+
+// Renders any entry as text.
+static size_t formatEntry(const log_entry_t *entry, char *buf) {
+    if (entry->rec.event == EV_TEXT)
+        return (size_t)formatDeferred(entry, buf, BUFF_W);
+    return (size_t)log_format_record(&entry->rec, NULL, buf, BUFF_W);
+}
+
+/*
+ * Claims up to max published entries starting at next_out.
+ * The claim is a CAS because overwrite-oldest producers may advance
+ * next_out too. Claimed slots stay occupied until ringRelease.
+ * returns: number of entries claimed, the first position in *start.
+ * */
+static size_t ringClaim(log_ring_t *ring, size_t max, size_t *start) {
+    for (;;) {
+        size_t out = atomic_load(&ring->next_out);
+        size_t n = 0;
+        while (n < max) {
+            log_slot_t *slot = &ring->slots[(out + n) & ring->mask];
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != out + n + 1)
+                break;
+            n++;
+        }
+        if (n == 0 || atomic_compare_exchange_strong(&ring->next_out, &out, out + n)) {
+            *start = out;
+            return n;
+        }
+    }
+}
+
+/*
+ * Sleeps until the ring has data or is closed, or timeout (if not NULL) expires.
+ * returns: 0 once the ring is closed and empty, 1 otherwise.
+ * */
+static int ringWait(log_ring_t *ring, const struct timespec *timeout) {
+    size_t out = atomic_load(&ring->next_out);
+    log_slot_t *slot = &ring->slots[out & ring->mask];
+    if (atomic_load(&ring->close)) {
+        return atomic_load_explicit(&slot->seq, memory_order_acquire) == out + 1;
+    }
+    unsigned int v = atomic_load(&ring->data_futex);
+    atomic_store(&ring->consumerWaiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != out + 1
+        && atomic_load(&ring->close) == 0)
+        futex_wait(&ring->data_futex, v, timeout);
+    atomic_store(&ring->consumerWaiting, 0);
+    return 1;
+}
+
+// Hands n consumed slots back to producers.
+static void ringRelease(log_ring_t *ring, size_t start, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        log_slot_t *slot = &ring->slots[(start + i) & ring->mask];
+        atomic_store_explicit(&slot->seq, start + i + ring->mask + 1, memory_order_release);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->producersWaiting, memory_order_relaxed)) {
+        atomic_fetch_add(&ring->space_futex, 1);
+        futex_wake(&ring->space_futex, INT32_MAX);
+    }
+}
+
+static void countBatch(log_stats_t *st, size_t n, size_t bytes) {
+    st->batches++;
+    st->entries += n;
+    st->bytes += bytes;
+    if (n > st->maxBatch)
+        st->maxBatch = n;
+}
+
+// Appends one entry to the file batch buffer, returns bytes added.
+static size_t encodeEntry(shared_buffer_t *sb, const log_entry_t *entry, char *fileBuf) {
+    if (sb->format == LOG_FORMAT_TEXT)
+        return formatEntry(entry, fileBuf);
+
+    memcpy(fileBuf, &entry->rec, sizeof(log_record_t));
+    if (entry->rec.event != EV_TEXT)
+        return sizeof(log_record_t);
+
+    // EV_TEXT: formatted text follows the record, padded to a whole record.
+    char *text = fileBuf + sizeof(log_record_t);
+    size_t n = formatEntry(entry, text);
+    ((log_record_t *)fileBuf)->value = (double)n;
+    size_t padded = (n + sizeof(log_record_t) - 1) / sizeof(log_record_t) * sizeof(log_record_t);
+    memset(text + n, 0, padded - n);
+    return sizeof(log_record_t) + padded;
+}
+
+// Forces the file to disk and accounts for the time it took.
+static void syncFile(log_ring_t *ring, log_writer_t *out) {
+    uint64_t start = monotonicNow();
+    if (log_writer_sync(out) != 0) {
+        perror("Error syncing log");
+    }
+    ring->stats.syncs++;
+    ring->stats.syncNs += monotonicNow() - start;
+}
+
+// Every run starts with a header, so runs appended to one file can be told apart.
+static void writeBinaryHeader(log_writer_t *out) {
+    log_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_FILE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.recordSize = sizeof(log_record_t);
+    log_writer_write(out, &header, sizeof(header));
+}
+
+// Appends the overflow counters to the file, producers are gone by now.
+static void writeDropCounters(shared_buffer_t *sb, log_writer_t *out) {
+    char *fileBuf = log_writer_buffer(out);
+    if (fileBuf == NULL)
+        return;
+    log_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.rec.timestamp = recordTime(sb);
+    entry.rec.wheel = LOG_NO_WHEEL;
+    entry.rec.handler = HANDLER_NONE;
+
+    size_t bytes = 0;
+    entry.rec.event = EV_LOG_DROPPED;
+    entry.rec.value = (double)atomic_load(&sb->file.dropped);
+    bytes += encodeEntry(sb, &entry, fileBuf + bytes);
+    entry.rec.event = EV_LOG_OVERWRITTEN;
+    entry.rec.value = (double)atomic_load(&sb->file.overwritten);
+    bytes += encodeEntry(sb, &entry, fileBuf + bytes);
+
+    if (log_writer_write(out, fileBuf, bytes) != 0) {
+        perror("Error writing log");
+    }
+}
+
+/*
+ * Function: log_consume
+ * --------------------------
+ * File logger thread body. Claims every published entry in one pass,
+ * encodes the batch into one buffer, hands the slots back to producers
+ * and then appends the buffer through the configured backend
+ * (one write(2), a memcpy into the mapped file, or an io_uring write
+ * that completes while the next batches are being drained).
+ * Written entries are forced to disk according to sb->sync: every
+ * syncEvery entries, within syncEvery ms of being written, or once
+ * on close. Every policy except LOG_SYNC_NONE syncs the tail on close.
+ *
+ * args: Pointer to a shared_buffer_t.
+ * */
+void *log_consume(void *args) {
+    shared_buffer_t *sb = (shared_buffer_t *)args;
+    log_ring_t *ring = &sb->file;
+    size_t maxBatch = ring->mask + 1 < LOG_MAX_BATCH ? ring->mask + 1 : LOG_MAX_BATCH;
+    log_writer_t out;
+    if (log_writer_open(&out, sb->fileName, sb->backend, maxBatch * (BUFF_W + 2 * sizeof(log_record_t))) != 0) {
+        perror( "Error opening file" );
+        printf( "Error code opening file: %d\n", errno );
+        printf( "Error opening file: %s\n", strerror( errno ) );
+        exit(-1);
+    }
+    // Reported backend is the one in use, after any io_uring fallback.
+    sb->backend = out.backend;
+    if (sb->format == LOG_FORMAT_BINARY)
+        writeBinaryHeader(&out);
+
+    uint64_t syncInterval = (uint64_t)sb->syncEvery * 1000000ull;
+    unsigned long unsynced = 0; // Entries written since the last sync.
+    uint64_t unsyncedSince = 0; // When the oldest of them was written.
+    for (;;) {
+        size_t start;
+        size_t n = ringClaim(ring, maxBatch, &start);
+        if (n == 0) {
+            // Ring is empty. Exit once closed, otherwise sleep until a producer publishes
+            // or, with an interval policy, until pending entries are due to be synced.
+            struct timespec timeout;
+            struct timespec *waitFor = NULL;
+            if (sb->sync == LOG_SYNC_INTERVAL && unsynced > 0) {
+                uint64_t now = monotonicNow();
+                if (now - unsyncedSince >= syncInterval) {
+                    syncFile(ring, &out);
+                    unsynced = 0;
+                    continue;
+                }
+                uint64_t left = unsyncedSince + syncInterval - now;
+                timeout.tv_sec = (time_t)(left / 1000000000ull);
+                timeout.tv_nsec = (long)(left % 1000000000ull);
+                waitFor = &timeout;
+            }
+            if (!ringWait(ring, waitFor))
+                break;
+            continue;
+        }
+
+        uint64_t batchStart = monotonicNow();
+        char *fileBuf = log_writer_buffer(&out);
+        if (fileBuf == NULL) {
+            perror("Error getting a log buffer");
+            exit(-1);
+        }
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; i++) {
+            bytes += encodeEntry(sb, &ring->slots[(start + i) & ring->mask].entry, fileBuf + bytes);
+        }
+        // Entries are copied out, producers can have the slots back before we hit the disk.
+        ringRelease(ring, start, n);
+
+        if (log_writer_write(&out, fileBuf, bytes) != 0) {
+            perror("Error writing log");
+        }
+        countBatch(&ring->stats, n, bytes);
+        uint64_t now = monotonicNow();
+        ring->stats.busyNs += now - batchStart;
+
+        if (unsynced == 0)
+            unsyncedSince = batchStart;
+        unsynced += n;
+        if ((sb->sync == LOG_SYNC_ENTRIES && unsynced >= sb->syncEvery)
+            || (sb->sync == LOG_SYNC_INTERVAL && now - unsyncedSince >= syncInterval)) {
+            syncFile(ring, &out);
+            unsynced = 0;
+        }
+    }
+    if (ring->policy != LOG_OVERFLOW_BLOCK) {
+        writeDropCounters(sb, &out);
+    }
+    if (sb->sync != LOG_SYNC_NONE) {
+        syncFile(ring, &out);
+    }
+    log_writer_close(&out);
+    return NULL;
+}
+
+/*
+ * Function: log_console_consume
+ * --------------------------
+ * Console logger thread body. Formats batches from the console ring and
+ * writes each with one fwrite, so producers never touch the stdout lock.
+ * With consoleRate set, lines beyond that many per second are dropped
+ * and a note with the count is printed once output resumes.
+ *
+ * args: Pointer to a shared_buffer_t.
+ * */
+void *log_console_consume(void *args) {
+    shared_buffer_t *sb = (shared_buffer_t *)args;
+    log_ring_t *ring = &sb->console;
+    if (sb->consoleMode == LOG_CONSOLE_OFF) {
+        return NULL;
+    }
+
+    size_t maxBatch = ring->mask + 1;
+    char *textBuf = malloc(maxBatch * BUFF_W + BUFF_W);
+    if (textBuf == NULL) {
+        perror("Error allocating console batch buffer");
+        exit(-1);
+    }
+    double tokens = sb->consoleRate;
+    uint64_t lastRefill = monotonicNow();
+    unsigned long pendingSuppressed = 0;
+    for (;;) {
+        size_t start;
+        size_t n = ringClaim(ring, maxBatch, &start);
+        if (n == 0) {
+            if (!ringWait(ring, NULL))
+                break;
+            continue;
+        }
+
+        if (sb->consoleRate > 0) {
+            uint64_t now = monotonicNow();
+            tokens += (double)(now - lastRefill) / 1e9 * sb->consoleRate;
+            if (tokens > sb->consoleRate)
+                tokens = sb->consoleRate;
+            lastRefill = now;
+        }
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (sb->consoleRate > 0) {
+                if (tokens < 1.0) {
+                    pendingSuppressed++;
+                    ring->stats.suppressed++;
+                    continue;
+                }
+                tokens -= 1.0;
+                if (pendingSuppressed > 0) {
+                    bytes += snprintf(textBuf + bytes, BUFF_W, "[console: %lu lines suppressed]\n", pendingSuppressed);
+                    pendingSuppressed = 0;
+                }
+            }
+            bytes += formatEntry(&ring->slots[(start + i) & ring->mask].entry, textBuf + bytes);
+        }
+        ringRelease(ring, start, n);
+
+        fwrite(textBuf, 1, bytes, stdout);
+        fflush(stdout);
+        countBatch(&ring->stats, n, bytes);
+    }
+    if (pendingSuppressed > 0) {
+        printf("[console: %lu lines suppressed]\n", pendingSuppressed);
+    }
+    free(textBuf);
+    return NULL;
+}
+
+/*
+ * Function: log_report
+ * --------------------------
+ * Prints the consumer counters. Call after both logger threads have been joined.
+ * */
+void log_report(shared_buffer_t *sb, FILE *out) {
+    log_stats_t *st = &sb->file.stats;
+    fprintf(out, "Logger (%s): %lu entries, %lu bytes in %lu batches (avg %.1f entries/batch, max %lu)\n",
+            log_backend_name(sb->backend), st->entries, st->bytes, st->batches,
+            st->batches ? (double)st->entries / st->batches : 0.0, st->maxBatch);
+    // Throughput counts the logger's own work (encoding, writing, syncing), not its idle time.
+    double workSec = (double)(st->busyNs + st->syncNs) / 1e9;
+    switch (sb->sync) {
+        case LOG_SYNC_ENTRIES:
+            fprintf(out, "Logger: sync every %u entries", sb->syncEvery);
+            break;
+        case LOG_SYNC_INTERVAL:
+            fprintf(out, "Logger: sync every %u ms", sb->syncEvery);
+            break;
+        case LOG_SYNC_COMPLETE:
+            fprintf(out, "Logger: sync on completion");
+            break;
+        case LOG_SYNC_NONE:
+        default:
+            fprintf(out, "Logger: no sync");
+            break;
+    }
+    fprintf(out, ", %lu syncs in %.3f ms, %.0f entries/s\n",
+            st->syncs, (double)st->syncNs / 1e6, workSec > 0 ? st->entries / workSec : 0.0);
+    if (sb->file.policy != LOG_OVERFLOW_BLOCK) {
+        fprintf(out, "Logger: %lu dropped (newest), %lu overwritten (oldest)\n",
+                atomic_load(&sb->file.dropped), atomic_load(&sb->file.overwritten));
+    }
+    if (sb->consoleMode != LOG_CONSOLE_OFF) {
+        st = &sb->console.stats;
+        fprintf(out, "Console: %lu entries in %lu batches, %lu dropped (backlog full), %lu suppressed (rate limit)\n",
+                st->entries, st->batches, atomic_load(&sb->console.dropped), st->suppressed);
+    }
+}
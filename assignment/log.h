@@ -0,0 +1,187 @@
+#ifndef ASSIGNMENT_LOG_H
+#define ASSIGNMENT_LOG_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "log_event.h"
+#include "log_writer.h"
+
+#define BUFF_W 256
+#define LOG_DEFAULT_CAPACITY 1024
+#define LOG_MAX_CONSOLE_BACKLOG 256 // Console ring capacity cap.
+#define LOG_MAX_BATCH 1024 // Upper bound on entries written per batch.
+#define LOG_MAX_ARGS 8
+#define LOG_DEFAULT_SYNC_EVERY 1000 // Entries or milliseconds, see log_sync.
+
+// Width of a captured log_printf argument, taken from the conversion spec.
+typedef enum log_arg_type {
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_STRING, // copied into the slot's text arena
+    ARG_POINTER
+} log_arg_type;
+
+typedef union log_arg {
+    long long i;
+    double d;
+    const void *p;
+} log_arg_t;
+
+typedef struct log_entry {
+    log_record_t rec;
+    // EV_TEXT only: format and raw arguments captured by log_printf.
+    const char *fmt;
+    unsigned char nargs;
+    unsigned char argTypes[LOG_MAX_ARGS];
+    log_arg_t args[LOG_MAX_ARGS]; // ARG_STRING holds an offset into text.
+    char text[BUFF_W]; // Copies of %s arguments.
+} log_entry_t;
+
+/*
+ * Ring slot.
+ * seq == position:     slot is free for the producer claiming that position.
+ * seq == position + 1: slot holds a published entry for the consumer.
+ */
+typedef struct log_slot {
+    atomic_size_t seq;
+    log_entry_t entry;
+} log_slot_t;
+
+// Consumer-side counters, only written by the ring's consumer thread.
+typedef struct log_stats {
+    unsigned long batches;
+    unsigned long entries;
+    unsigned long bytes;
+    unsigned long maxBatch;
+    unsigned long suppressed; // Console lines cut by the rate limit.
+    unsigned long syncs;
+    uint64_t syncNs; // Time spent forcing the file to disk.
+    uint64_t busyNs; // Time spent encoding and writing batches.
+} log_stats_t;
+
+typedef enum log_format {
+    LOG_FORMAT_TEXT,   // Records are formatted by the logger thread.
+    LOG_FORMAT_BINARY  // Records are written raw, see log_decode.
+} log_format;
+
+typedef enum log_console_mode {
+    LOG_CONSOLE_OFF,
+    LOG_CONSOLE_FULL,
+    LOG_CONSOLE_SUMMARY // Cycle distance, completion and warnings only.
+} log_console_mode;
+
+// What a producer does when the file ring is full.
+typedef enum log_overflow {
+    LOG_OVERFLOW_BLOCK,           // Wait for space (lossless).
+    LOG_OVERFLOW_DROP_NEWEST,     // Discard the entry being logged.
+    LOG_OVERFLOW_OVERWRITE_OLDEST // Discard the oldest unwritten entry.
+} log_overflow;
+
+// When the file sink forces logged data to disk (group commit).
+typedef enum log_sync {
+    LOG_SYNC_NONE,     // Left to kernel writeback.
+    LOG_SYNC_ENTRIES,  // After every syncEvery entries.
+    LOG_SYNC_INTERVAL, // At most syncEvery ms after an entry was written.
+    LOG_SYNC_COMPLETE  // Once, when the scenario completes.
+} log_sync;
+
+typedef struct log_config {
+    size_t capacity; // Rounded up to a power of two.
+    log_format format;
+    log_level level; // Runtime floor, on top of LOG_MIN_LEVEL.
+    log_console_mode consoleMode;
+    unsigned int consoleRate; // Console lines per second, 0 = unlimited.
+    log_overflow overflow;
+    log_backend backend;
+    log_sync sync;
+    unsigned int syncEvery;
+} log_config_t;
+
+#define LOG_CONFIG_DEFAULT { LOG_DEFAULT_CAPACITY, LOG_FORMAT_TEXT, LOG_TRACE, LOG_CONSOLE_FULL, 0, LOG_OVERFLOW_BLOCK, \
+                             LOG_BACKEND_WRITE, LOG_SYNC_NONE, LOG_DEFAULT_SYNC_EVERY }
+
+/*
+ * Bounded multi-producer / single-consumer ring.
+ * Producers claim a position with a CAS on next_in and publish through the
+ * slot sequence number. The consumer claims batches with a CAS on next_out
+ * (overwrite-oldest producers may advance it as well).
+ * Neither side takes a lock; the futex words are only touched when the
+ * consumer has found the ring empty or a producer has found it full.
+ */
+typedef struct log_ring {
+    log_slot_t *slots;
+    size_t mask;
+    _Alignas(64) atomic_size_t next_in;
+    _Alignas(64) atomic_size_t next_out;
+    _Alignas(64) atomic_uint data_futex;
+    atomic_int consumerWaiting;
+    _Alignas(64) atomic_uint space_futex;
+    atomic_int producersWaiting;
+    log_overflow policy;
+    atomic_ulong dropped;     // Entries refused because the ring was full.
+    atomic_ulong overwritten; // Entries discarded to make room (overwrite-oldest).
+    atomic_int close;
+    log_stats_t stats;
+} log_ring_t;
+
+/*
+ * Scenario logger. Every entry goes to the file sink (drained by
+ * log_consume) and, depending on consoleMode, to the console sink
+ * (drained by log_console_consume). The console ring never blocks
+ * producers; when it is full the line is dropped and counted.
+ * Set clock after log_init to stamp records with simulated time;
+ * the logger's own pacing (rate limit, sync interval) stays real time.
+ */
+typedef struct shared_buffer {
+    log_ring_t file;
+    log_ring_t console;
+    const atomic_ullong *clock; // Simulated time for record timestamps, NULL for CLOCK_MONOTONIC.
+    char *fileName;
+    log_format format;
+    log_backend backend;
+    log_sync sync;
+    unsigned int syncEvery;
+    log_level level;
+    log_console_mode consoleMode;
+    unsigned int consoleRate;
+} shared_buffer_t;
+
+int log_init(shared_buffer_t *sb, char *fileName, const log_config_t *config);
+void log_destroy(shared_buffer_t *sb);
+void log_close(shared_buffer_t *sb);
+void *log_consume(void *args);
+void *log_console_consume(void *args);
+void log_printf(shared_buffer_t *sb, log_level level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void log_event(shared_buffer_t *sb, log_event_id event, int wheel, log_handler handler,
+               unsigned int cycle, double value);
+void log_report(shared_buffer_t *sb, FILE *out);
+
+/*
+ * Level filtering happens at the call site, before any argument is
+ * captured or slot claimed. level is a constant, so with the
+ * LOG_MIN_LEVEL test false the whole call is dead code.
+ */
+#define LOG_ENABLED(sb, lvl) ((int)(lvl) >= LOG_MIN_LEVEL && (int)(lvl) >= (int)(sb)->level)
+
+#define LOG_EVENT(sb, event, wheel, handler, cycle, value) \
+    do { \
+        if (LOG_ENABLED(sb, event##_LEVEL)) \
+            log_event(sb, event, wheel, handler, cycle, value); \
+    } while (0)
+
+#define LOG_PRINTF(sb, lvl, ...) \
+    do { \
+        if (LOG_ENABLED(sb, lvl)) \
+            log_printf(sb, lvl, __VA_ARGS__); \
+    } while (0)
+
+#endif //ASSIGNMENT_LOG_H
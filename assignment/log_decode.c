@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "log_event.h"
+#include "log.h"
+
+/*
+ * log_decode
+ * Turns a binary scenario log (--binary-log) back into the text format.
+ * -t prefixes every line with its time since the first record and its cycle.
+ * */
+int main(int argc, char *argv[]) {
+    int withTimes = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1) {
+        switch (opt) {
+            case 't':
+                withTimes = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t] <log.bin>\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-t] <log.bin>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[optind], "rb");
+    if (fp == NULL) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    log_record_t rec;
+    char text[BUFF_W + sizeof(log_record_t)];
+    char line[BUFF_W];
+    uint64_t firstTimestamp = 0;
+    int haveHeader = 0;
+    int runStart = 0; // The next record is the first of a run.
+    unsigned long records = 0;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        // Runs appended to the same file each start with a header; times restart at each.
+        if (memcmp(&rec, LOG_FILE_MAGIC, 8) == 0) {
+            log_file_header_t *header = (log_file_header_t *)&rec;
+            if (header->recordSize != sizeof(log_record_t)) {
+                fprintf(stderr, "Unsupported record size %u\n", header->recordSize);
+                fclose(fp);
+                return 1;
+            }
+            haveHeader = 1;
+            runStart = 1;
+            continue;
+        }
+        if (!haveHeader) {
+            fprintf(stderr, "%s: not a binary scenario log\n", argv[optind]);
+            fclose(fp);
+            return 1;
+        }
+
+        text[0] = '\0';
+        if (rec.event == EV_TEXT) {
+            size_t len = (size_t)rec.value;
+            size_t padded = (len + sizeof(log_record_t) - 1) / sizeof(log_record_t) * sizeof(log_record_t);
+            if (len >= BUFF_W || fread(text, 1, padded, fp) != padded) {
+                fprintf(stderr, "Truncated text record after %lu records\n", records);
+                break;
+            }
+            text[len] = '\0';
+        }
+
+        if (runStart) {
+            firstTimestamp = rec.timestamp;
+            runStart = 0;
+        }
+        if (withTimes)
+            printf("[+%.6f] [cycle %u] ", (double)(rec.timestamp - firstTimestamp) / 1e9, rec.cycle);
+        log_format_record(&rec, text, line, sizeof(line));
+        fputs(line, stdout);
+        records++;
+    }
+    fclose(fp);
+    return 0;
+}
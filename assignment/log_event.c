@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <strings.h>
+
+#include "log_event.h"
+
+typedef struct log_event_desc {
+    const char *name;
+    log_level level;
+    log_args args;
+    const char *fmt;
+} log_event_desc_t;
+
+#define LOG_EVENT_DESC(name, level, args, fmt) { #name, level, args, fmt },
+static const log_event_desc_t events[LOG_EVENT_COUNT] = {
+    LOG_EVENTS(LOG_EVENT_DESC)
+};
+#undef LOG_EVENT_DESC
+
+static const char *handlerNames[] = {
+    "",
+    "SinkHandler",
+    "FreeHandler",
+    "BlockHandler"
+};
+
+static const char *levelNames[] = { "trace", "debug", "info", "warn" };
+
+// Returns the log_level called name, or -1.
+int log_level_parse(const char *name) {
+    for (int i = 0; i < (int)(sizeof(levelNames) / sizeof(levelNames[0])); i++) {
+        if (strcasecmp(name, levelNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *log_event_name(unsigned int event) {
+    return event < LOG_EVENT_COUNT ? events[event].name : "EV_UNKNOWN";
+}
+
+log_level log_event_level(unsigned int event) {
+    return event < LOG_EVENT_COUNT ? events[event].level : LOG_WARN;
+}
+
+const char *log_handler_name(unsigned int handler) {
+    return handler < sizeof(handlerNames) / sizeof(handlerNames[0]) ? handlerNames[handler] : "UnknownHandler";
+}
+
+/*
+ * Function: log_format_record
+ * --------------------------
+ * Renders a record as the text line the scenario used to print.
+ *
+ * rec: record to format.
+ * text: payload of an EV_TEXT record, ignored for other events.
+ * buf, len: destination, always NUL terminated.
+ *
+ * returns: number of characters written (excluding the NUL), truncated to len - 1.
+ * */
+int log_format_record(const log_record_t *rec, const char *text, char *buf, size_t len) {
+    int n;
+    if (rec->event >= LOG_EVENT_COUNT) {
+        n = snprintf(buf, len, "<unknown event %u>\n", rec->event);
+    }
+    else if (rec->event == EV_TEXT) {
+        n = snprintf(buf, len, "%s", text != NULL ? text : "");
+    }
+    else {
+        const log_event_desc_t *ev = &events[rec->event];
+        const char *handler = log_handler_name(rec->handler);
+        switch (ev->args) {
+            case ARGS_WHEEL:
+                n = snprintf(buf, len, ev->fmt, rec->wheel);
+                break;
+            case ARGS_HANDLER:
+                n = snprintf(buf, len, ev->fmt, handler);
+                break;
+            case ARGS_HANDLER_WHEEL:
+                n = snprintf(buf, len, ev->fmt, handler, rec->wheel);
+                break;
+            case ARGS_HANDLER_VALUE:
+                n = snprintf(buf, len, ev->fmt, handler, (int)rec->value);
+                break;
+            case ARGS_VALUE:
+                n = snprintf(buf, len, ev->fmt, rec->value);
+                break;
+            case ARGS_COUNT:
+                n = snprintf(buf, len, ev->fmt, (unsigned long)rec->value);
+                break;
+            case ARGS_NONE:
+            default:
+                n = snprintf(buf, len, "%s", ev->fmt);
+                break;
+        }
+    }
+    if (n < 0)
+        n = 0;
+    if ((size_t)n >= len)
+        n = (int)len - 1;
+    return n;
+}
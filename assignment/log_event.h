@@ -0,0 +1,115 @@
+#ifndef ASSIGNMENT_LOG_EVENT_H
+#define ASSIGNMENT_LOG_EVENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Argument layout of an event's format string.
+ * The record fields are fed to the format in this order.
+ */
+typedef enum log_args {
+    ARGS_NONE,          // no conversions
+    ARGS_WHEEL,         // %d wheel
+    ARGS_HANDLER,       // %s handler name
+    ARGS_HANDLER_WHEEL, // %s handler name, %d wheel
+    ARGS_HANDLER_VALUE, // %s handler name, %d (int)value
+    ARGS_VALUE,         // %f value
+    ARGS_COUNT          // %lu (unsigned long)value
+} log_args;
+
+typedef enum log_level {
+    LOG_TRACE,
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN
+} log_level;
+
+// Build-time floor, calls below it are compiled out (see LOG_ENABLED in log.h).
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_TRACE
+#endif
+
+/*
+ * Every message the scenario logs, with its level.
+ * Binary logs store the id only, so append new events at the end.
+ */
+#define LOG_EVENTS(X) \
+    X(EV_TEXT,               LOG_INFO,  ARGS_NONE,          NULL) \
+    X(EV_SOLUTIONS_STARTING, LOG_DEBUG, ARGS_NONE,          "Starting Solution Threads\n") \
+    X(EV_MONITOR_STARTING,   LOG_DEBUG, ARGS_NONE,          "Starting VectorMonitor\n") \
+    X(EV_SCENARIO_COMPLETED, LOG_INFO,  ARGS_NONE,          "SCENARIO_COMPLETED\n") \
+    X(EV_WHEEL_WAITING,      LOG_TRACE, ARGS_WHEEL,         "Wheel %d: Waiting for problems to be solved...\n") \
+    X(EV_WHEEL_VECTORING,    LOG_TRACE, ARGS_WHEEL,         "Wheel %d: Vectoring...\n") \
+    X(EV_WHEEL_SINKING,      LOG_INFO,  ARGS_WHEEL,         "Wheel %d: Sinking...\n") \
+    X(EV_WHEEL_BLOCKED,      LOG_INFO,  ARGS_WHEEL,         "Wheel %d: Blocked...\n") \
+    X(EV_WHEEL_FREEWHEELING, LOG_INFO,  ARGS_WHEEL,         "Wheel %d: FreeWheeling...\n") \
+    X(EV_WHEEL_EXITING,      LOG_TRACE, ARGS_WHEEL,         "Wheel %d: Exiting\n") \
+    X(EV_HANDLER_WAITING,    LOG_TRACE, ARGS_HANDLER,       "%s: Waiting for signal...\n") \
+    X(EV_HANDLER_SIGNALLED,  LOG_DEBUG, ARGS_HANDLER,       "%s: Signal Received, searching for problem\n") \
+    X(EV_HANDLER_RELEASING,  LOG_TRACE, ARGS_HANDLER,       "%s: signaling & releasing lock...\n") \
+    X(EV_HANDLER_TERMINATE,  LOG_WARN,  ARGS_NONE,          "Terminating Scenario...\n") \
+    X(EV_PROBLEM_RESOLVING,  LOG_DEBUG, ARGS_HANDLER_WHEEL, "%s: Resolving problem for wheel %d\n") \
+    X(EV_PROBLEM_SOLVED,     LOG_INFO,  ARGS_HANDLER,       "%s: Problem Solved\n") \
+    X(EV_PROBLEM_ATTEMPT,    LOG_DEBUG, ARGS_HANDLER_VALUE, "%s: Failed to solved problem, attempt: %d\n") \
+    X(EV_PROBLEM_GAVE_UP,    LOG_WARN,  ARGS_HANDLER,       "%s: Failed to solve problem after 3 Attempts...\n") \
+    X(EV_DISTANCE,           LOG_INFO,  ARGS_VALUE,         "==========================\n" \
+                                                            "TOTAL DISTANCE VECTORED: %f\n" \
+                                                            "==========================\n") \
+    X(EV_LOG_DROPPED,        LOG_WARN,  ARGS_COUNT,         "Log: %lu entries dropped (ring full)\n") \
+    X(EV_LOG_OVERWRITTEN,    LOG_WARN,  ARGS_COUNT,         "Log: %lu entries overwritten (ring full)\n")
+
+#define LOG_EVENT_ENUM(name, level, args, fmt) name,
+typedef enum log_event_id {
+    LOG_EVENTS(LOG_EVENT_ENUM)
+    LOG_EVENT_COUNT
+} log_event_id;
+#undef LOG_EVENT_ENUM
+
+// <event>_LEVEL constants, so call sites can filter on a compile-time constant.
+#define LOG_EVENT_LEVEL(name, level, args, fmt) name##_LEVEL = level,
+enum {
+    LOG_EVENTS(LOG_EVENT_LEVEL)
+};
+#undef LOG_EVENT_LEVEL
+
+typedef enum log_handler {
+    HANDLER_NONE,
+    HANDLER_SINK,
+    HANDLER_FREE,
+    HANDLER_BLOCK
+} log_handler;
+
+#define LOG_NO_WHEEL 0xFFFF
+
+/*
+ * On-disk record of the binary log, written as-is (host byte order).
+ * EV_TEXT records carry (size_t)value bytes of text after the record,
+ * padded to a multiple of sizeof(log_record_t).
+ */
+typedef struct log_record {
+    uint64_t timestamp; // CLOCK_MONOTONIC or simulated time, ns
+    double value;
+    uint32_t cycle;
+    uint16_t wheel;
+    uint8_t event;
+    uint8_t handler;
+} log_record_t;
+
+#define LOG_FILE_MAGIC "SCNLOG01"
+
+// Written at the start of every binary log file, same size as a record.
+typedef struct log_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t reserved;
+} log_file_header_t;
+
+const char *log_event_name(unsigned int event);
+log_level log_event_level(unsigned int event);
+const char *log_handler_name(unsigned int handler);
+int log_level_parse(const char *name);
+int log_format_record(const log_record_t *rec, const char *text, char *buf, size_t len);
+
+#endif //ASSIGNMENT_LOG_EVENT_H
@@ -0,0 +1,449 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "log_writer.h"
+
+// One registered batch buffer of the io_uring backend.
+typedef struct log_uring_buf {
+    char *data;
+    size_t len;
+    size_t done;   // Bytes the kernel has completed so far.
+    size_t offset; // File offset of data[0].
+    int busy;      // A write from this buffer is in flight.
+} log_uring_buf_t;
+
+/*
+ * io_uring instance of the io_uring backend, driven through the raw
+ * syscalls. Each buffer has at most one write in flight, so the
+ * submission queue (LOG_URING_BUFFERS entries) never overflows.
+ */
+struct log_uring {
+    int fd;
+    int fileFd;
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_cqe *cqes;
+    log_uring_buf_t bufs[LOG_URING_BUFFERS];
+    unsigned int next;     // Buffer the next batch is encoded into.
+    unsigned int inFlight;
+};
+
+static int writeAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Reserves disk blocks up to size, falling back to a sparse extend.
+static int preallocate(int fd, size_t from, size_t size) {
+    if (fallocate(fd, 0, (off_t)from, (off_t)(size - from)) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return -1;
+    return ftruncate(fd, (off_t)size);
+}
+
+// Grows the file and mapping so that at least need bytes fit.
+static int growMap(log_writer_t *w, size_t need) {
+    size_t size = w->mapSize;
+    while (size < need)
+        size += LOG_MMAP_CHUNK;
+    if (preallocate(w->fd, w->mapSize, size) != 0)
+        return -1;
+    void *map = w->map == NULL
+                ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0)
+                : mremap(w->map, w->mapSize, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return -1;
+    w->map = map;
+    w->mapSize = size;
+    return 0;
+}
+
+static int uringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+    int ret;
+    do {
+        ret = (int)syscall(SYS_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static void *mapRing(int fd, size_t size, off_t offset) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void uringFree(struct log_uring *u) {
+    if (u->fd >= 0)
+        close(u->fd);
+    if (u->sqes != NULL)
+        munmap(u->sqes, u->sqesSize);
+    if (u->cqRing != NULL && u->cqRing != u->sqRing)
+        munmap(u->cqRing, u->cqRingSize);
+    if (u->sqRing != NULL)
+        munmap(u->sqRing, u->sqRingSize);
+    for (int i = 0; i < LOG_URING_BUFFERS; i++)
+        free(u->bufs[i].data);
+    if (u->fileFd >= 0)
+        close(u->fileFd);
+    free(u);
+}
+
+/*
+ * Sets up the ring, maps its queues and registers LOG_URING_BUFFERS
+ * page-aligned buffers of w->bufSize bytes.
+ * returns: 0 on success, -1 with errno set (nothing left open) otherwise.
+ * */
+static int uringOpen(log_writer_t *w, const char *fileName) {
+    struct log_uring *u = calloc(1, sizeof(*u));
+    if (u == NULL)
+        return -1;
+    u->fd = -1;
+    u->fileFd = open(fileName, O_WRONLY | O_CREAT, 0644);
+    struct stat st;
+    if (u->fileFd < 0 || fstat(u->fileFd, &st) != 0)
+        goto fail;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(SYS_io_uring_setup, LOG_URING_BUFFERS, &p);
+    if (u->fd < 0)
+        goto fail;
+    u->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cqRingSize > u->sqRingSize)
+            u->sqRingSize = u->cqRingSize;
+        u->cqRingSize = u->sqRingSize;
+    }
+    u->sqRing = mapRing(u->fd, u->sqRingSize, IORING_OFF_SQ_RING);
+    if (u->sqRing == NULL)
+        goto fail;
+    u->cqRing = p.features & IORING_FEAT_SINGLE_MMAP
+                ? u->sqRing : mapRing(u->fd, u->cqRingSize, IORING_OFF_CQ_RING);
+    u->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mapRing(u->fd, u->sqesSize, IORING_OFF_SQES);
+    if (u->cqRing == NULL || u->sqes == NULL)
+        goto fail;
+    u->sqTail = (unsigned int *)((char *)u->sqRing + p.sq_off.tail);
+    u->sqMask = (unsigned int *)((char *)u->sqRing + p.sq_off.ring_mask);
+    u->sqArray = (unsigned int *)((char *)u->sqRing + p.sq_off.array);
+    u->cqHead = (unsigned int *)((char *)u->cqRing + p.cq_off.head);
+    u->cqTail = (unsigned int *)((char *)u->cqRing + p.cq_off.tail);
+    u->cqMask = (unsigned int *)((char *)u->cqRing + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cqRing + p.cq_off.cqes);
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (w->bufSize + page - 1) / page * page;
+    struct iovec iov[LOG_URING_BUFFERS];
+    for (int i = 0; i < LOG_URING_BUFFERS; i++) {
+        void *data;
+        int err = posix_memalign(&data, page, size);
+        if (err != 0) {
+            errno = err;
+            goto fail;
+        }
+        u->bufs[i].data = data;
+        iov[i].iov_base = data;
+        iov[i].iov_len = size;
+    }
+    if (syscall(SYS_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, LOG_URING_BUFFERS) != 0)
+        goto fail;
+
+    w->fd = u->fileFd;
+    w->end = (size_t)st.st_size;
+    w->uring = u;
+    return 0;
+
+fail: {
+        int err = errno;
+        uringFree(u);
+        errno = err;
+        return -1;
+    }
+}
+
+// Queues the unwritten part of buffer idx at its file offset.
+static int uringSubmit(struct log_uring *u, unsigned int idx) {
+    log_uring_buf_t *b = &u->bufs[idx];
+    unsigned int tail = *u->sqTail;
+    unsigned int slot = tail & *u->sqMask;
+    struct io_uring_sqe *sqe = &u->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = u->fileFd;
+    sqe->off = b->offset + b->done;
+    sqe->addr = (uintptr_t)(b->data + b->done);
+    sqe->len = (unsigned int)(b->len - b->done);
+    sqe->buf_index = (uint16_t)idx;
+    sqe->user_data = idx;
+    u->sqArray[slot] = slot;
+    atomic_store_explicit((atomic_uint *)u->sqTail, tail + 1, memory_order_release);
+    return uringEnter(u->fd, 1, 0, 0) < 0 ? -1 : 0;
+}
+
+/*
+ * Handles every posted completion, resubmitting the rest of short writes.
+ * With wait set, first blocks until at least one write has completed.
+ * */
+static int uringReap(struct log_uring *u, int wait) {
+    if (wait && uringEnter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+        return -1;
+    unsigned int head = *u->cqHead;
+    while (head != atomic_load_explicit((atomic_uint *)u->cqTail, memory_order_acquire)) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+        unsigned int idx = (unsigned int)cqe->user_data;
+        int res = cqe->res;
+        atomic_store_explicit((atomic_uint *)u->cqHead, ++head, memory_order_release);
+
+        log_uring_buf_t *b = &u->bufs[idx];
+        if (res > 0) {
+            b->done += (size_t)res;
+            if (b->done < b->len && uringSubmit(u, idx) == 0)
+                continue;
+        }
+        if (b->done < b->len) {
+            errno = res < 0 ? -res : EIO;
+            perror("Error writing log");
+        }
+        b->busy = 0;
+        u->inFlight--;
+    }
+    return 0;
+}
+
+// Returns the next batch buffer once the write previously issued from it has completed.
+static log_uring_buf_t *uringAcquire(struct log_uring *u) {
+    log_uring_buf_t *b = &u->bufs[u->next];
+    uringReap(u, 0);
+    while (b->busy) {
+        if (uringReap(u, 1) != 0)
+            return NULL;
+    }
+    return b;
+}
+
+/*
+ * Function: log_writer_open
+ * --------------------------
+ * Opens fileName for appending with the given backend. Batches of up
+ * to bufSize bytes are encoded into log_writer_buffer.
+ * If io_uring is not available, falls back to the write backend.
+ *
+ * returns: 0 on success, -1 with errno set otherwise.
+ * */
+int log_writer_open(log_writer_t *w, const char *fileName, log_backend backend, size_t bufSize) {
+    memset(w, 0, sizeof(*w));
+    w->backend = backend;
+    w->bufSize = bufSize;
+    if (backend == LOG_BACKEND_URING) {
+        if (uringOpen(w, fileName) == 0)
+            return 0;
+        fprintf(stderr, "io_uring unavailable (%s), using the write backend\n", strerror(errno));
+        backend = LOG_BACKEND_WRITE;
+        w->backend = backend;
+    }
+
+    if (backend == LOG_BACKEND_WRITE) {
+        w->buf = malloc(bufSize);
+        if (w->buf == NULL)
+            return -1;
+        w->fd = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (w->fd < 0)
+            goto fail;
+        return 0;
+    }
+
+    // The mmap backend encodes batches straight into the mapping, so it has no buffer.
+    w->fd = open(fileName, O_RDWR | O_CREAT, 0644);
+    if (w->fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(w->fd, &st) != 0)
+        goto fail;
+    w->end = (size_t)st.st_size;
+    w->mapSize = w->end;
+    if (growMap(w, w->end + LOG_MMAP_CHUNK) != 0)
+        goto fail;
+    return 0;
+
+fail: {
+        int err = errno;
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->buf);
+        w->fd = -1;
+        w->buf = NULL;
+        errno = err;
+        return -1;
+    }
+}
+
+/*
+ * Function: log_writer_buffer
+ * --------------------------
+ * Buffer of bufSize bytes to encode the next batch into. With mmap it
+ * is the mapping itself at the end of the file, grown if need be; with
+ * io_uring this may wait for the oldest write in flight to complete.
+ *
+ * returns: the buffer, or NULL if growing the mapping or waiting for a
+ * completion failed.
+ * */
+char *log_writer_buffer(log_writer_t *w) {
+    if (w->backend == LOG_BACKEND_WRITE)
+        return w->buf;
+    if (w->backend == LOG_BACKEND_MMAP) {
+        if (w->end + w->bufSize > w->mapSize && growMap(w, w->end + w->bufSize) != 0)
+            return NULL;
+        return w->map + w->end;
+    }
+    log_uring_buf_t *b = uringAcquire(w->uring);
+    return b != NULL ? b->data : NULL;
+}
+
+/*
+ * Function: log_writer_write
+ * --------------------------
+ * Appends len bytes. The mmap backend only makes a syscall when it has
+ * to grow the file, by at least LOG_MMAP_CHUNK at a time, and buf is
+ * already in place if it came from log_writer_buffer.
+ * The io_uring backend queues the write and returns without waiting
+ * for it; buf is copied first unless it came from log_writer_buffer.
+ * */
+int log_writer_write(log_writer_t *w, const void *buf, size_t len) {
+    if (w->backend == LOG_BACKEND_WRITE)
+        return writeAll(w->fd, buf, len);
+
+    if (w->backend == LOG_BACKEND_URING) {
+        struct log_uring *u = w->uring;
+        unsigned int idx = u->next;
+        log_uring_buf_t *b = uringAcquire(u);
+        if (b == NULL)
+            return -1;
+        if (buf != b->data) {
+            if (len > w->bufSize) {
+                errno = EMSGSIZE;
+                return -1;
+            }
+            memcpy(b->data, buf, len);
+        }
+        b->len = len;
+        b->done = 0;
+        b->offset = w->end;
+        b->busy = 1;
+        w->end += len;
+        u->inFlight++;
+        u->next = (idx + 1) % LOG_URING_BUFFERS;
+        if (uringSubmit(u, idx) != 0) {
+            b->busy = 0;
+            u->inFlight--;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (buf != w->map + w->end) {
+        if (w->end + len > w->mapSize && growMap(w, w->end + len) != 0)
+            return -1;
+        memcpy(w->map + w->end, buf, len);
+    }
+    w->end += len;
+    return 0;
+}
+
+/*
+ * Function: log_writer_sync
+ * --------------------------
+ * Forces everything written so far to disk. The io_uring backend
+ * first waits for the writes in flight to complete.
+ *
+ * returns: 0 on success, -1 with errno set otherwise.
+ * */
+int log_writer_sync(log_writer_t *w) {
+    switch (w->backend) {
+        case LOG_BACKEND_MMAP:
+            return w->end > 0 ? msync(w->map, w->end, MS_SYNC) : 0;
+        case LOG_BACKEND_URING:
+            while (w->uring->inFlight > 0) {
+                if (uringReap(w->uring, 1) != 0)
+                    return -1;
+            }
+            return fdatasync(w->fd);
+        case LOG_BACKEND_WRITE:
+        default:
+            return fdatasync(w->fd);
+    }
+}
+
+// Logical size of the log file, including anything written this run.
+size_t log_writer_size(log_writer_t *w) {
+    if (w->backend != LOG_BACKEND_WRITE)
+        return w->end;
+    struct stat st;
+    return fstat(w->fd, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+void log_writer_close(log_writer_t *w) {
+    if (w->backend == LOG_BACKEND_URING) {
+        // Let the writes in flight land before the buffers go away.
+        while (w->uring->inFlight > 0 && uringReap(w->uring, 1) == 0)
+            ;
+        uringFree(w->uring);
+        w->uring = NULL;
+        w->fd = -1;
+        return;
+    }
+    if (w->backend == LOG_BACKEND_MMAP && w->map != NULL) {
+        munmap(w->map, w->mapSize);
+        // Drop the unused preallocated tail.
+        if (ftruncate(w->fd, (off_t)w->end) != 0)
+            perror("Error truncating log");
+    }
+    close(w->fd);
+    free(w->buf);
+    w->fd = -1;
+    w->buf = NULL;
+    w->map = NULL;
+}
+
+const char *log_backend_name(log_backend backend) {
+    switch (backend) {
+        case LOG_BACKEND_MMAP:
+            return "mmap";
+        case LOG_BACKEND_URING:
+            return "io_uring";
+        case LOG_BACKEND_WRITE:
+        default:
+            return "write";
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef ASSIGNMENT_LOG_WRITER_H
+#define ASSIGNMENT_LOG_WRITER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LOG_MMAP_CHUNK (4u << 20) // Preallocation / growth step of the mmap backend.
+#define LOG_URING_BUFFERS 4 // Registered batch buffers (and writes in flight) of the io_uring backend.
+
+typedef enum log_backend {
+    LOG_BACKEND_WRITE, // write(2) per batch on an O_APPEND fd.
+    LOG_BACKEND_MMAP,  // memcpy into a preallocated, mapped file.
+    LOG_BACKEND_URING  // Asynchronous io_uring writes from registered buffers.
+} log_backend;
+
+struct log_uring;
+
+/*
+ * Output file of the file sink. Only the logger thread touches it.
+ * Batches are encoded into the buffer returned by log_writer_buffer.
+ * mmap backend: the file is mapped from offset 0 to mapSize (which is
+ * also its allocated length) and end is the logical end of the log.
+ * The file is cut back to end on close.
+ * io_uring backend: end is the offset the next write goes to.
+ */
+typedef struct log_writer {
+    log_backend backend;
+    int fd;
+    char *buf;
+    size_t bufSize;
+    char *map;
+    size_t mapSize;
+    size_t end;
+    struct log_uring *uring;
+} log_writer_t;
+
+int log_writer_open(log_writer_t *w, const char *fileName, log_backend backend, size_t bufSize);
+char *log_writer_buffer(log_writer_t *w);
+int log_writer_write(log_writer_t *w, const void *buf, size_t len);
+int log_writer_sync(log_writer_t *w);
+size_t log_writer_size(log_writer_t *w);
+void log_writer_close(log_writer_t *w);
+const char *log_backend_name(log_backend backend);
+
+#endif //ASSIGNMENT_LOG_WRITER_H
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+
+static const char *csvHeader =
+        "type,run,seed,wheels,executor,cycles,distance,outcome,wall_s,"
+        "cycle_p50_us,cycle_p99_us,cycle_max_us,resolve_p50_us,resolve_p99_us,resolve_max_us\n";
+
+/*
+ * Function: results_open
+ * --------------------------
+ * Opens path for appending, writing the CSV header if the file is new
+ * or empty.
+ *
+ * returns: 0 on success, -1 if the file could not be opened.
+ * */
+int results_open(results_t *r, const char *path, results_format format) {
+    r->format = format;
+    r->file = fopen(path, "a");
+    if (r->file == NULL)
+        return -1;
+    r->buffer = malloc(RESULTS_BUFFER);
+    if (r->buffer != NULL)
+        setvbuf(r->file, r->buffer, _IOFBF, RESULTS_BUFFER);
+    fseek(r->file, 0, SEEK_END);
+    if (format == RESULTS_CSV && ftell(r->file) == 0)
+        fputs(csvHeader, r->file);
+    return 0;
+}
+
+/*
+ * Function: results_append
+ * --------------------------
+ * Adds one record. Safe to call from several threads at once.
+ *
+ * returns: 0, or -1 if the record did not fit a line or the write failed.
+ * */
+int results_append(results_t *r, const result_record_t *rec) {
+    char line[RESULTS_LINE];
+    int len;
+    if (r->format == RESULTS_CSV) {
+        len = snprintf(line, sizeof(line), "%s,%d,%llu,%d,%s,%u,%.6f,%s,%.6f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                       rec->type, rec->run, (unsigned long long)rec->seed, rec->wheels, rec->executor,
+                       rec->cycles, rec->distance, rec->outcome, rec->wallSec,
+                       rec->cycleP50Us, rec->cycleP99Us, rec->cycleMaxUs,
+                       rec->resolveP50Us, rec->resolveP99Us, rec->resolveMaxUs);
+    }
+    else {
+        // Every string field is one of the program's own names, so nothing needs escaping.
+        len = snprintf(line, sizeof(line),
+                       "{\"type\":\"%s\",\"run\":%d,\"seed\":%llu,\"wheels\":%d,\"executor\":\"%s\","
+                       "\"cycles\":%u,\"distance\":%.6f,\"outcome\":\"%s\","
+                       "\"wall_s\":%.6f,\"cycle_p50_us\":%.3f,\"cycle_p99_us\":%.3f,\"cycle_max_us\":%.3f,"
+                       "\"resolve_p50_us\":%.3f,\"resolve_p99_us\":%.3f,\"resolve_max_us\":%.3f}\n",
+                       rec->type, rec->run, (unsigned long long)rec->seed, rec->wheels, rec->executor,
+                       rec->cycles, rec->distance, rec->outcome, rec->wallSec,
+                       rec->cycleP50Us, rec->cycleP99Us, rec->cycleMaxUs,
+                       rec->resolveP50Us, rec->resolveP99Us, rec->resolveMaxUs);
+    }
+    if (len < 0 || (size_t)len >= sizeof(line))
+        return -1;
+    return fwrite(line, 1, (size_t)len, r->file) == (size_t)len ? 0 : -1;
+}
+
+// Flushes what is still buffered and closes the file.
+void results_close(results_t *r) {
+    if (r->file != NULL)
+        fclose(r->file);
+    free(r->buffer);
+    r->file = NULL;
+    r->buffer = NULL;
+}
+
+// returns: 0 and sets format if name is jsonl or csv, -1 otherwise.
+int results_parse_format(const char *name, results_format *format) {
+    if (strcmp(name, "jsonl") == 0) {
+        *format = RESULTS_JSONL;
+        return 0;
+    }
+    if (strcmp(name, "csv") == 0) {
+        *format = RESULTS_CSV;
+        return 0;
+    }
+    return -1;
+}
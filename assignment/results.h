@@ -0,0 +1,51 @@
+#ifndef ASSIGNMENT_RESULTS_H
+#define ASSIGNMENT_RESULTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RESULTS_BUFFER (64 * 1024) // stdio buffer of the results file: many records per write.
+#define RESULTS_LINE 1024
+
+typedef enum results_format {
+    RESULTS_JSONL, // One JSON object per line.
+    RESULTS_CSV    // A header line when the file is new, then one row per run.
+} results_format;
+
+// One finished scenario run. Latencies are in µs, 0 when nothing was measured.
+typedef struct result_record {
+    const char *type;
+    int run; // -1 for menu runs.
+    uint64_t seed; // The master seed: --seed S --first-run RUN --runs 1 repeats the run.
+    int wheels;
+    const char *executor;
+    unsigned int cycles;
+    double distance; // totalDistanceVectored.
+    const char *outcome;
+    double wallSec;
+    double cycleP50Us;
+    double cycleP99Us;
+    double cycleMaxUs;
+    double resolveP50Us;
+    double resolveP99Us;
+    double resolveMaxUs;
+} result_record_t;
+
+/*
+ * Results file shared by every scenario of the process. Records are
+ * formatted on the caller's stack and handed to stdio in one fwrite, so
+ * concurrent scenarios never interleave within a line, and the large
+ * buffer turns thousands of runs into a few appends.
+ */
+typedef struct results {
+    FILE *file;
+    results_format format;
+    char *buffer;
+} results_t;
+
+int results_open(results_t *r, const char *path, results_format format);
+int results_append(results_t *r, const result_record_t *rec);
+void results_close(results_t *r);
+int results_parse_format(const char *name, results_format *format);
+
+#endif //ASSIGNMENT_RESULTS_H
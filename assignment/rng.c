@@ -0,0 +1,52 @@
+#include "rng.h"
+
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ull // SplitMix64 increment.
+
+// SplitMix64 finaliser: a bijection that scatters nearby inputs.
+static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Key of stream within seed; distinct streams give unrelated keys.
+uint64_t rng_derive(uint64_t seed, uint64_t stream) {
+    return mix(mix(seed + GOLDEN_GAMMA) ^ (stream * GOLDEN_GAMMA + GOLDEN_GAMMA));
+}
+
+// Seeds r as stream of seed, filling its state from SplitMix64.
+void rng_seed(rng_t *r, uint64_t seed, uint64_t stream) {
+    uint64_t x = rng_derive(seed, stream);
+    for (int i = 0; i < 4; i++) {
+        x += GOLDEN_GAMMA;
+        r->s[i] = mix(x);
+    }
+}
+
+// xoshiro256**
+uint64_t rng_next(rng_t *r) {
+    uint64_t *s = r->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// The index-th SplitMix64 output of the stream keyed key.
+uint64_t rng_at(uint64_t key, uint64_t index) {
+    return mix(key + (index + 1) * GOLDEN_GAMMA);
+}
+
+// Maps x uniformly enough onto 0 to n - 1 (multiply-shift, no division).
+unsigned int rng_below(uint64_t x, unsigned int n) {
+    return (unsigned int)(((x >> 32) * n) >> 32);
+}
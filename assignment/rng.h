@@ -0,0 +1,24 @@
+#ifndef ASSIGNMENT_RNG_H
+#define ASSIGNMENT_RNG_H
+
+#include <stdint.h>
+
+/*
+ * Seedable random streams, so runs can be reproduced from one master
+ * seed and random draws share no state between threads.
+ *
+ * rng_t is a xoshiro256** generator for sequential draws; rng_seed
+ * gives each stream id its own state. rng_at is counter based: the
+ * index-th draw of a stream, computable by anyone holding the key.
+ */
+typedef struct rng {
+    uint64_t s[4];
+} rng_t;
+
+uint64_t rng_derive(uint64_t seed, uint64_t stream);
+void rng_seed(rng_t *r, uint64_t seed, uint64_t stream);
+uint64_t rng_next(rng_t *r);
+uint64_t rng_at(uint64_t key, uint64_t index);
+unsigned int rng_below(uint64_t x, unsigned int n);
+
+#endif //ASSIGNMENT_RNG_H
@@ -0,0 +1,250 @@
+#define SYNC_IMPLEMENTATION
+#include <string.h>
+
+#include "sync.h"
+
+#ifdef SYNC_STATS
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void statsInit(sync_stats_t *stats, const char *name) {
+    memset(stats, 0, sizeof(*stats));
+    stats->name = name[0] == '&' ? name + 1 : name;
+}
+
+// returns: the slot for site, claiming a free one on its first call.
+static sync_site_stats_t *siteStats(sync_stats_t *stats, const sync_site_t *site) {
+    for (int i = 0; i < SYNC_MAX_SITES - 1; i++) {
+        sync_site_stats_t *s = &stats->sites[i];
+        const sync_site_t *seen = atomic_load_explicit(&s->site, memory_order_acquire);
+        if (seen == NULL && atomic_compare_exchange_strong(&s->site, &seen, site))
+            return s;
+        if (seen == site) // Also where a failed claim leaves the winner.
+            return s;
+    }
+    return &stats->sites[SYNC_MAX_SITES - 1];
+}
+
+static void addWait(sync_site_stats_t *s, uint64_t ns) {
+    atomic_fetch_add_explicit(&s->waitNs, ns, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&s->maxWaitNs, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak(&s->maxWaitNs, &max, ns))
+        ;
+}
+
+// Called with m just acquired at s.
+static void mutexAcquired(sync_mutex_t *m, sync_site_stats_t *s) {
+    atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+    m->holder = s;
+    m->lockedNs = nowNs();
+}
+
+// Called with m held, just before it is released.
+static void mutexReleasing(sync_mutex_t *m) {
+    if (m->holder != NULL)
+        atomic_fetch_add_explicit(&m->holder->holdNs, nowNs() - m->lockedNs, memory_order_relaxed);
+    m->holder = NULL;
+}
+#endif
+
+void sync_mutex_init(sync_mutex_t *m, int fibers SYNC_NAMED) {
+    m->fibers = fibers;
+#ifdef SYNC_STATS
+    statsInit(&m->stats, name);
+    m->holder = NULL;
+#endif
+    if (fibers)
+        fiber_mutex_init(&m->fiber);
+    else
+        pthread_mutex_init(&m->thread, NULL);
+}
+
+void sync_mutex_lock(sync_mutex_t *m SYNC_AT) {
+#ifdef SYNC_STATS
+    sync_site_stats_t *s = siteStats(&m->stats, site);
+    int acquired = m->fibers ? fiber_mutex_trylock(&m->fiber) : pthread_mutex_trylock(&m->thread) == 0;
+    if (acquired) {
+        mutexAcquired(m, s);
+        return;
+    }
+    atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+    uint64_t start = nowNs();
+#endif
+    if (m->fibers)
+        fiber_mutex_lock(&m->fiber);
+    else
+        pthread_mutex_lock(&m->thread);
+#ifdef SYNC_STATS
+    addWait(s, nowNs() - start);
+    mutexAcquired(m, s);
+#endif
+}
+
+void sync_mutex_unlock(sync_mutex_t *m) {
+#ifdef SYNC_STATS
+    mutexReleasing(m);
+#endif
+    if (m->fibers)
+        fiber_mutex_unlock(&m->fiber);
+    else
+        pthread_mutex_unlock(&m->thread);
+}
+
+void sync_mutex_destroy(sync_mutex_t *m) {
+    if (!m->fibers)
+        pthread_mutex_destroy(&m->thread);
+}
+
+void sync_cond_init(sync_cond_t *c, int fibers SYNC_NAMED) {
+    c->fibers = fibers;
+#ifdef SYNC_STATS
+    statsInit(&c->stats, name);
+#endif
+    if (fibers)
+        fiber_cond_init(&c->fiber);
+    else
+        pthread_cond_init(&c->thread, NULL);
+}
+
+// c and m must both be fiber objects or both pthread ones.
+// With SYNC_STATS, the mutex held after waking counts towards the wait's call site.
+void sync_cond_wait(sync_cond_t *c, sync_mutex_t *m SYNC_AT) {
+#ifdef SYNC_STATS
+    sync_site_stats_t *s = siteStats(&c->stats, site);
+    mutexReleasing(m);
+    uint64_t start = nowNs();
+#endif
+    if (c->fibers)
+        fiber_cond_wait(&c->fiber, &m->fiber);
+    else
+        pthread_cond_wait(&c->thread, &m->thread);
+#ifdef SYNC_STATS
+    addWait(s, nowNs() - start);
+    mutexAcquired(m, s);
+#endif
+}
+
+void sync_cond_signal(sync_cond_t *c SYNC_AT) {
+#ifdef SYNC_STATS
+    atomic_fetch_add_explicit(&siteStats(&c->stats, site)->calls, 1, memory_order_relaxed);
+#endif
+    if (c->fibers)
+        fiber_cond_signal(&c->fiber);
+    else
+        pthread_cond_signal(&c->thread);
+}
+
+void sync_cond_broadcast(sync_cond_t *c SYNC_AT) {
+#ifdef SYNC_STATS
+    atomic_fetch_add_explicit(&siteStats(&c->stats, site)->calls, 1, memory_order_relaxed);
+#endif
+    if (c->fibers)
+        fiber_cond_broadcast(&c->fiber);
+    else
+        pthread_cond_broadcast(&c->thread);
+}
+
+void sync_cond_destroy(sync_cond_t *c) {
+    if (!c->fibers)
+        pthread_cond_destroy(&c->thread);
+}
+
+// returns: 0 on success, -1 otherwise.
+int sync_barrier_init(sync_barrier_t *b, int fibers, barrier_type type, unsigned int count SYNC_NAMED) {
+    b->fibers = fibers;
+#ifdef SYNC_STATS
+    statsInit(&b->stats, name);
+#endif
+    b->type = fibers ? BARRIER_PTHREAD : type;
+    if (fibers) {
+        fiber_barrier_init(&b->fiber, count);
+        return 0;
+    }
+    if (type == BARRIER_PTHREAD)
+        return pthread_barrier_init(&b->thread, NULL, count) == 0 ? 0 : -1;
+    return barrier_init(&b->spin, type, count);
+}
+
+// id identifies the caller among the count participants (0 to count - 1).
+int sync_barrier_wait(sync_barrier_t *b, unsigned int id SYNC_AT) {
+#ifdef SYNC_STATS
+    sync_site_stats_t *s = siteStats(&b->stats, site);
+    uint64_t start = nowNs();
+#endif
+    int result;
+    if (b->fibers)
+        result = fiber_barrier_wait(&b->fiber);
+    else if (b->type == BARRIER_PTHREAD)
+        result = pthread_barrier_wait(&b->thread);
+    else
+        result = barrier_wait(&b->spin, id);
+#ifdef SYNC_STATS
+    atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+    addWait(s, nowNs() - start);
+#endif
+    return result;
+}
+
+void sync_barrier_destroy(sync_barrier_t *b) {
+    if (b->fibers)
+        return;
+    if (b->type == BARRIER_PTHREAD)
+        pthread_barrier_destroy(&b->thread);
+    else
+        barrier_destroy(&b->spin);
+}
+
+// Sleeps the calling fiber, or thread when not on a fiber.
+void sync_sleep(const struct timespec *ts) {
+    if (fiber_current() != NULL)
+        fiber_sleep((uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec);
+    else
+        nanosleep(ts, NULL);
+}
+
+#ifdef SYNC_STATS
+/*
+ * Function: sync_stats_report
+ * --------------------------
+ * Prints one line per call site that used the object, longest total
+ * wait first, or nothing if the object was never used. Wait is time
+ * blocked in the call; hold is time the mutex was then held for.
+ * */
+void sync_stats_report(const sync_stats_t *stats, FILE *out) {
+    const sync_site_stats_t *order[SYNC_MAX_SITES];
+    int n = 0;
+    for (int i = 0; i < SYNC_MAX_SITES; i++) {
+        const sync_site_stats_t *s = &stats->sites[i];
+        if (atomic_load(&s->calls) == 0)
+            continue;
+        int j = n++;
+        for (; j > 0 && atomic_load(&order[j - 1]->waitNs) < atomic_load(&s->waitNs); j--)
+            order[j] = order[j - 1];
+        order[j] = s;
+    }
+    if (n == 0)
+        return;
+    fprintf(out, "Contention: %s\n", stats->name);
+    fprintf(out, "  %-36s %-9s %10s %10s %10s %10s %10s\n",
+            "site", "op", "calls", "contended", "wait ms", "max us", "hold ms");
+    for (int i = 0; i < n; i++) {
+        const sync_site_stats_t *s = order[i];
+        const sync_site_t *site = atomic_load(&s->site);
+        char where[64];
+        if (site != NULL) {
+            const char *file = strrchr(site->file, '/');
+            snprintf(where, sizeof(where), "%s:%d %s", file != NULL ? file + 1 : site->file, site->line, site->func);
+        }
+        else {
+            snprintf(where, sizeof(where), "(other sites)");
+        }
+        fprintf(out, "  %-36s %-9s %10llu %10llu %10.3f %10.1f %10.3f\n",
+                where, site != NULL ? site->op : "", atomic_load(&s->calls), atomic_load(&s->contended),
+                (double)atomic_load(&s->waitNs) / 1e6, (double)atomic_load(&s->maxWaitNs) / 1e3,
+                (double)atomic_load(&s->holdNs) / 1e6);
+    }
+}
+#endif
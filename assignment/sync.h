@@ -0,0 +1,128 @@
+#ifndef ASSIGNMENT_SYNC_H
+#define ASSIGNMENT_SYNC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fiber.h"
+#include "barrier.h"
+
+#ifdef SYNC_STATS
+#define SYNC_MAX_SITES 16 // Call sites tracked per object; the last slot takes any overflow.
+
+// A call in the source, recorded by the macros at the end of this file.
+typedef struct sync_site {
+    const char *file;
+    const char *func;
+    int line;
+    const char *op; // "lock", "wait", "signal", "broadcast" or "barrier".
+} sync_site_t;
+
+// What one call site did to one object; times in ns.
+typedef struct sync_site_stats {
+    _Atomic(const sync_site_t *) site; // NULL while the slot is free.
+    atomic_ullong calls;     // Acquisitions, wakeups from a wait, signals or barrier episodes.
+    atomic_ullong contended; // lock: found the mutex held.
+    atomic_ullong waitNs;    // Blocked in the call.
+    atomic_ullong maxWaitNs;
+    atomic_ullong holdNs;    // lock and wait: held the mutex afterwards, until the next unlock or wait.
+} sync_site_stats_t;
+
+// Per-object contention, reported by sync_stats_report.
+typedef struct sync_stats {
+    const char *name; // The expression the object was initialised with.
+    sync_site_stats_t sites[SYNC_MAX_SITES];
+} sync_stats_t;
+
+#define SYNC_AT , const sync_site_t *site
+#define SYNC_NAMED , const char *name
+#else
+#define SYNC_AT
+#define SYNC_NAMED
+#endif
+
+/*
+ * Scenario synchronisation objects. Each is either a pthread object or,
+ * when initialised with fibers set, its fiber-aware counterpart, so the
+ * same blocking code runs on threads and on fibers.
+ */
+typedef struct sync_mutex {
+    int fibers;
+    union {
+        pthread_mutex_t thread;
+        fiber_mutex_t fiber;
+    };
+#ifdef SYNC_STATS
+    sync_stats_t stats;
+    sync_site_stats_t *holder; // Where the owner acquired it; guarded by the mutex itself.
+    uint64_t lockedNs;
+#endif
+} sync_mutex_t;
+
+typedef struct sync_cond {
+    int fibers;
+    union {
+        pthread_cond_t thread;
+        fiber_cond_t fiber;
+    };
+#ifdef SYNC_STATS
+    sync_stats_t stats;
+#endif
+} sync_cond_t;
+
+// Without fibers, type picks the barrier; fibers always use fiber_barrier_t.
+typedef struct sync_barrier {
+    int fibers;
+    barrier_type type;
+    union {
+        pthread_barrier_t thread;
+        fiber_barrier_t fiber;
+        barrier_t spin;
+    };
+#ifdef SYNC_STATS
+    sync_stats_t stats;
+#endif
+} sync_barrier_t;
+
+void sync_mutex_init(sync_mutex_t *m, int fibers SYNC_NAMED);
+void sync_mutex_lock(sync_mutex_t *m SYNC_AT);
+void sync_mutex_unlock(sync_mutex_t *m);
+void sync_mutex_destroy(sync_mutex_t *m);
+
+void sync_cond_init(sync_cond_t *c, int fibers SYNC_NAMED);
+void sync_cond_wait(sync_cond_t *c, sync_mutex_t *m SYNC_AT);
+void sync_cond_signal(sync_cond_t *c SYNC_AT);
+void sync_cond_broadcast(sync_cond_t *c SYNC_AT);
+void sync_cond_destroy(sync_cond_t *c);
+
+int sync_barrier_init(sync_barrier_t *b, int fibers, barrier_type type, unsigned int count SYNC_NAMED);
+int sync_barrier_wait(sync_barrier_t *b, unsigned int id SYNC_AT);
+void sync_barrier_destroy(sync_barrier_t *b);
+
+void sync_sleep(const struct timespec *ts);
+
+#ifdef SYNC_STATS
+void sync_stats_report(const sync_stats_t *stats, FILE *out);
+
+/*
+ * Every call passes a static description of where it was made, and
+ * every init the text of the object it was given, so callers need no
+ * changes. sync.c itself sees the plain functions.
+ */
+#ifndef SYNC_IMPLEMENTATION
+#define SYNC_SITE(op) ({ static const sync_site_t site_ = {__FILE__, __func__, __LINE__, op}; &site_; })
+#define sync_mutex_init(m, fibers) sync_mutex_init(m, fibers, #m)
+#define sync_mutex_lock(m) sync_mutex_lock(m, SYNC_SITE("lock"))
+#define sync_cond_init(c, fibers) sync_cond_init(c, fibers, #c)
+#define sync_cond_wait(c, m) sync_cond_wait(c, m, SYNC_SITE("wait"))
+#define sync_cond_signal(c) sync_cond_signal(c, SYNC_SITE("signal"))
+#define sync_cond_broadcast(c) sync_cond_broadcast(c, SYNC_SITE("broadcast"))
+#define sync_barrier_init(b, fibers, type, count) sync_barrier_init(b, fibers, type, count, #b)
+#define sync_barrier_wait(b, id) sync_barrier_wait(b, id, SYNC_SITE("barrier"))
+#endif
+#endif
+
+#endif //ASSIGNMENT_SYNC_H
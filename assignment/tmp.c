@@ -3,14 +3,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-
-#define NUM_WHEELS 6
+#include <getopt.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "executor.h"
+#include "sync.h"
+#include "dispatch.h"
+#include "rng.h"
+#include "trace.h"
+#include "usage.h"
+#include "hist.h"
+#include "results.h"
+
+#define DEFAULT_NUM_WHEELS 6
+#define MAX_NUM_WHEELS (LOG_NO_WHEEL - 1) // Wheel ids must fit a log record.
+#define WHEEL_STACK_SIZE (64 * 1024) // Wheel threads need little stack; keeps large fleets mappable.
+#define SCENARIO_FIBERS(wheels) ((wheels) + 1) // Wheels and the monitor.
+#define SCENARIO_BODIES(wheels) ((wheels) + 3) // Wheels, the monitor and the two loggers.
+#define DEFAULT_CYCLE_MS 1000 // Pause between wheel cycles.
+#define DEFAULT_SOLVERS 3 // Problem solvers, shared by every scenario.
 #define MIN_PROBLEMS_PER_SCENARIO 5
 #define PROBLEM_RETRY_ATTEMPTS 3
 #define MIN_VECTOR_DISTANCE 1
 #define FAILURE_PROBABILITY 20
-#define BUFF_H 4
-#define BUFF_W 256
+#define BENCH_RUNS 50 // bench_scenario runs per scenario type and wheel count, unless --runs is given.
+
+/*
+ * Latency probes. The scenario always stamps cycle starts, problems and
+ * releases, one clock read per cycle or problem, for --results.
+ * BENCH_RECORD adds the time since a stamp to one of bench_scenario's
+ * histograms and is compiled in for SCENARIO_BENCH only.
+ */
+#ifdef SCENARIO_BENCH
+#define BENCH_RECORD(histogram, since) hist_record(&(histogram), hist_now() - (since))
+#else
+#define BENCH_RECORD(histogram, since) ((void)0)
+#endif
 
 typedef enum wheel_state {
     WORKING,
@@ -34,108 +65,675 @@ typedef enum scenario_type {
     FFA
 } scenario_type;
 
+// How wheel cycles are paced.
+typedef enum scenario_clock {
+    REAL_TIME,   // Wheels sleep cycleMs between cycles.
+    VIRTUAL_TIME // No sleeping; simulated time advances cycleMs per cycle.
+} scenario_clock;
+
+// What runs the wheels, problem handlers and monitor.
+typedef enum scenario_executor {
+    THREADS, // One thread each.
+    TASKS,   // Tasks on the shared work-stealing executor.
+    FIBERS   // One fiber each, run by the shared executor's workers.
+} scenario_executor;
+
+// Whether state transitions go through a trace (--record, --replay).
+typedef enum scenario_trace {
+    NO_TRACE,
+    RECORDING, // Transitions are appended to the scenario's trace.
+    REPLAYING  // Transitions wait their turn in the loaded trace.
+} scenario_trace;
+
 typedef enum scenario_outcome {
     PASSED,
     FAILED
 } scenario_outcome;
 
+struct batch_t;
 
-typedef struct shared_buffer {
-    pthread_mutex_t lock;
-    pthread_cond_t
-            new_data_cond,
-            new_space_cond;
-    char c[BUFF_H][BUFF_W];
-    int next_in,
-            next_out,
-            count;
-    int close;
-    char *fileName;
-} shared_buffer_t;
-
-typedef struct problem_conditions_t {
-    pthread_cond_t sinking_condition;
-    pthread_cond_t blocked_condition;
-    pthread_cond_t freeWheeling_condition;
-} problem_conditions_t;
-
-typedef struct wheel_t {
-    int id;
-    wheel_state state;
-} wheel_t;
+// One scenario execution: what to run and, once finished, how it went.
+typedef struct scenario_job_t {
+    scenario_type type;
+    int run;                // Batch run number, -1 for menu runs.
+    struct batch_t *batch;  // Notified when the scenario finishes, NULL for menu runs.
+    pthread_t thread;
+    int finished;           // Guarded by batch->mutex.
+    scenario_outcome outcome;
+    unsigned int cycles;
+} scenario_job_t;
+
+/*
+ * Batch runner state. Scenario threads flag their job finished and
+ * signal done_condition, so runBatch collects results in finishing order.
+ */
+typedef struct batch_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t done_condition;
+} batch_t;
+
+
+struct scenario_t;
+
+// A thread the scenario starts, and what it used once it has returned.
+typedef struct scenario_body_t {
+    void *(*fn)(void *);
+    void *arg;
+    thread_usage_t usage;
+} scenario_body_t;
+
+typedef struct scenario_wheel_t {
+    struct scenario_t *scenario;
+    int wheel;
+} scenario_wheel_t;
+
+/*
+ * Per-wheel data, one array per field (structure of arrays),
+ * allocated once per scenario. A wheel's id is its index.
+ */
+typedef struct wheel_set_t {
+    int count;
+    _Atomic(wheel_state) *state; // Written by the wheel, and by the solver while the wheel waits.
+    pthread_t *threads;
+    scenario_wheel_t *threadData; // Argument of each wheel thread or task.
+    executor_task_t *tasks; // Cycle task of each wheel, NULL with THREADS.
+    dispatch_item_t *problems; // Problem report of each wheel.
+} wheel_set_t;
 
+/*
+ * mutex guards scenario state transitions (raising a problem, releasing
+ * it, completion) and the waits on them; state itself is atomic so that
+ * vectoring wheels can check it without the lock.
+ */
 typedef struct scenario_t {
-    wheel_t wheels[NUM_WHEELS];
-    scenario_state state;
+    wheel_set_t wheels;
+    _Atomic(scenario_state) state;
     scenario_type type;
-    pthread_mutex_t mutex;
-    pthread_cond_t continue_condition;
-    pthread_cond_t problem_condition;
-    pthread_cond_t scenarioComplete_condition;
-    problem_conditions_t conditions;
-    pthread_barrier_t wheelSetup_barrier;
-    pthread_barrier_t solutionSetup_barrier;
-    pthread_barrier_t wheelCycle_barrier;
+    sync_mutex_t mutex;
+    sync_cond_t continue_condition;
+    sync_cond_t problem_condition;
+    sync_cond_t scenarioComplete_condition;
+    sync_barrier_t wheelSetup_barrier;
+    sync_barrier_t wheelCycle_barrier;
     shared_buffer_t log;
+    char logFileName[64];
     scenario_outcome outcome;
-    int currentCycleProblems;
-    int solvedProblemCount;
+    atomic_int currentCycleProblems; // Problems drawn this cycle.
+    atomic_int solvedProblemCount;
     double totalDistanceVectored;
     int multiReset;
+    unsigned int cycle;
+    int finished; // Monitor's verdict, only written between the two cycle barrier waits.
+    atomic_ullong simTime; // Simulated ns since start, advanced by the monitor (VIRTUAL_TIME).
+    uint64_t seed; // Derived from masterSeed and the run; keys every wheel's draws.
+    rng_t solveRng; // Problem fix attempts; problems are solved one at a time.
+    // Record/replay; the trace is guarded by mutex.
+    scenario_trace tracing;
+    trace_t *trace; // NULL with NO_TRACE.
+    sync_cond_t turn_condition; // REPLAYING: the trace cursor moved.
+    // Latency probe timestamps, guarded by mutex except cycleStartNs (monitor only).
+    uint64_t cycleStartNs;
+    uint64_t problemNs; // The current problem was reported.
+    uint64_t releaseNs; // The last problem was released.
+    // --results: this run's latencies, NULL otherwise.
+    hist_t *cycleTimes;
+    hist_t *resolveTimes;
+    uint64_t wallNs; // scenario_run, loggers included.
+    // TASKS only; guarded by mutex like the rest of the cycle state.
+    executor_t *executor; // NULL unless TASKS.
+    executor_task_t cycleTask; // Submits every wheel task.
+    executor_task_t monitorTask; // Closes the cycle once pendingWheels reaches 0.
+    atomic_int pendingWheels;
+    int *deferred; // Wheels that found a problem being solved, resumed by solveProblem.
+    int deferredCount;
+    // Threads started: wheels and the monitor (THREADS only), then the file and console loggers.
+    scenario_body_t *bodies;
+    thread_usage_t handlerUsage[HANDLER_BLOCK]; // THREADS: solver time per handler, guarded by mutex.
+    // FIBERS only: wheels, then the monitor.
+    fiber_t *fibers; // NULL unless FIBERS.
+    char *fiberStacks;
+    size_t fiberStacksSize;
 } scenario_t;
 
-typedef struct scenario_wheel_t {
-    scenario_t *scenario;
-    wheel_t *wheel;
-} scenario_wheel_t;
+// Records a log event stamped with the scenario's current cycle, filtered by level.
+#define scenarioLog(scenario, event, wheel, handler, value) \
+    LOG_EVENT(&(scenario)->log, event, wheel, handler, (scenario)->cycle, value)
 
 int isScenarioComplete(scenario_t *scenario);
-wheel_state getRandomizedWheelState();
+wheel_state getRandomizedWheelState(int r);
+unsigned int wheelDraw(scenario_t *scenario, int wheel);
 
 void *scenario_create(void *args);
 void scenario_destroy(scenario_t *scenario);
-scenario_t scenario_init(scenario_type scType);
+void scenario_init(scenario_t *scenario, scenario_type scType, int numWheels, int run);
 int scenario_run(scenario_t *scenario);
 
 void *menuLoop();
+int runBatch(scenario_type type, int runs, int concurrency);
+int parseScenarioType(const char *name);
 void *wheel_start(void *args);
-int trySolveProblem(scenario_t *scenario, wheel_t * wheel, wheel_state pType);
-void *sinkProblemHandler(void * args);
-void *freeWheelProblemHandler(void * args);
-void *blockProblemHandler(void * args);
+int trySolveProblem(scenario_t *scenario, int wheel, wheel_state pType);
+void solveProblem(dispatch_item_t *item);
 void *scenarioMonitor(void *p_scenario);
-wheel_state randomizeSingleState(wheel_state secondaryState);
-wheel_state randomizeStateForScenario(scenario_t *scenario);
+wheel_state randomizeSingleState(int r, wheel_state secondaryState);
+wheel_state randomizeStateForScenario(scenario_t *scenario, int wheel);
+
+char* generateFileName(scenario_type scType, int run, char *fn, size_t len);
+log_handler getHandlerForProblemType(wheel_state pType);
+
+int processWheelState(int wheel, scenario_t *scenario);
+void signalProblem(scenario_t *scenario, int wheel, wheel_state pType);
+void waitForContinueSignal(int wheel, scenario_t *scenario);
+int closeCycle(scenario_t *scenario);
+
+int traceTurn(scenario_t *scenario, trace_kind kind, int wheel, int value, int recorded);
+wheel_state setWheelState(scenario_t *scenario, int wheel, wheel_state state, int drawn);
+int setScenarioState(scenario_t *scenario, int wheel, scenario_state state);
+int solveDraw(scenario_t *scenario, int wheel);
+
+void scenarioRunThreads(scenario_t *scenario);
+void bodyStart(scenario_t *scenario, pthread_t *thread, int fiber, void *(*fn)(void *), void *arg,
+               pthread_attr_t *attr);
+void bodyJoin(scenario_t *scenario, pthread_t *thread, int fiber);
+void scenarioRunTasks(scenario_t *scenario);
+void solutionsStarting(scenario_t *scenario);
+void *accountedBody(void *args);
+void reportUsage(scenario_t *scenario, FILE *out);
+int writeResult(scenario_t *scenario, int run);
+void cycleStartTask(executor_task_t *task);
+void wheelCycleTask(executor_task_t *task);
+void wheelResumeTask(executor_task_t *task);
+void wheelProceed(scenario_t *scenario, int wheel);
+void wheelArrive(scenario_t *scenario);
+void monitorStepTask(executor_task_t *task);
+
+static log_config_t logConfig = LOG_CONFIG_DEFAULT;
+static int wheelCount = DEFAULT_NUM_WHEELS;
+static unsigned int cycleMs = DEFAULT_CYCLE_MS;
+#ifdef SCENARIO_BENCH
+static scenario_clock clockMode = VIRTUAL_TIME; // Keeps the cycleMs pause out of the cycle histogram.
+#else
+static scenario_clock clockMode = REAL_TIME;
+#endif
+static scenario_executor executorMode = THREADS;
+static barrier_type barrierType = BARRIER_PTHREAD; // Wheel barriers with THREADS.
+static executor_t executor; // Shared by every scenario with TASKS or FIBERS.
+static dispatcher_t dispatcher; // Solves every scenario's problems.
+static uint64_t masterSeed; // --seed, or the start time.
+static int firstRun; // --first-run: number of a batch's first run, so one run of a larger batch can be repeated.
+static const char *recordPath; // --record: every scenario saves a trace here (batch runs add .<run>).
+static trace_t replayTrace; // --replay: the trace every scenario replays.
+static int replaying;
+static const char *resultsPath; // --results: every run appends a record here.
+static results_format resultsFormat = RESULTS_JSONL;
+static results_t results;
+static const char *scenarioTypeNames[] = {"rock", "sink", "free", "multi"}; // By scenario_type, as --scenario takes them.
+static const char *executorNames[] = {"threads", "tasks", "fibers"}; // By scenario_executor.
+#ifdef SCENARIO_BENCH
+static hist_t cycleLatency;   // Cycle barrier to cycle barrier, as seen by the monitor.
+static hist_t resolveLatency; // Problem reported to waiting wheels released.
+static hist_t wakeLatency;    // Release to a waiting wheel running again.
+int benchSweep(int type, int runs, int concurrency, int wheels);
+#endif
 
-shared_buffer_t log_init(scenario_type scType);
-void log_destroy(shared_buffer_t *sb);
-void *log_consume(void *args);
-void *log_print(shared_buffer_t *sb, char string[]);
+/*
+ * main
+ * Parses options, shows menu, handles input & starts scenarios*/
+int main(int argc, char *argv[]) {
+    static struct option longOptions[] = {
+            {"log-capacity", required_argument, NULL, 'c'},
+            {"binary-log", no_argument, NULL, 'b'},
+            {"log-level", required_argument, NULL, 'l'},
+            {"console", required_argument, NULL, 'o'},
+            {"console-rate", required_argument, NULL, 'r'},
+            {"log-overflow", required_argument, NULL, 'f'},
+            {"log-backend", required_argument, NULL, 'k'},
+            {"log-sync", required_argument, NULL, 's'},
+            {"log-sync-every", required_argument, NULL, 'e'},
+            {"wheels", required_argument, NULL, 'w'},
+            {"scenario", required_argument, NULL, 'S'},
+            {"runs", required_argument, NULL, 'n'},
+            {"seed", required_argument, NULL, 'd'},
+            {"cycle-ms", required_argument, NULL, 'm'},
+            {"jobs", required_argument, NULL, 'j'},
+            {"first-run", required_argument, NULL, 'N'},
+            {"clock", required_argument, NULL, 't'},
+            {"executor", required_argument, NULL, 'x'},
+            {"workers", required_argument, NULL, 'W'},
+            {"solvers", required_argument, NULL, 'v'},
+            {"barrier", required_argument, NULL, 'B'},
+            {"record", required_argument, NULL, 'R'},
+            {"replay", required_argument, NULL, 'P'},
+            {"results", required_argument, NULL, 'J'},
+            {"results-format", required_argument, NULL, 'F'},
+            {NULL, 0, NULL, 0}
+    };
+    int opt;
+    int level;
+    int batchType = -1; // Set by --scenario, selects batch mode.
+    int runs = 0; // 0: not given.
+#ifdef SCENARIO_BENCH
+    int wheelsGiven = 0; // --wheels narrows the sweep to that count.
+#endif
+    int concurrency = 1;
+    int workers = 0; // 0: one per core.
+    int solvers = DEFAULT_SOLVERS;
+    int status;
+    masterSeed = (uint64_t)time(NULL);
+    while ((opt = getopt_long(argc, argv, "c:bl:o:r:f:k:s:e:w:S:n:d:m:j:t:x:W:v:B:R:P:J:F:N:", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                logConfig.capacity = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                logConfig.format = LOG_FORMAT_BINARY;
+                break;
+            case 'l':
+                level = log_level_parse(optarg);
+                if (level < 0) {
+                    printf("Unknown log level: %s (trace, debug, info, warn)\n", optarg);
+                    return 1;
+                }
+                logConfig.level = (log_level)level;
+                break;
+            case 'o':
+                if (strcmp(optarg, "full") == 0)
+                    logConfig.consoleMode = LOG_CONSOLE_FULL;
+                else if (strcmp(optarg, "summary") == 0)
+                    logConfig.consoleMode = LOG_CONSOLE_SUMMARY;
+                else if (strcmp(optarg, "off") == 0)
+                    logConfig.consoleMode = LOG_CONSOLE_OFF;
+                else {
+                    printf("Unknown console mode: %s (full, summary, off)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                logConfig.consoleRate = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (strcmp(optarg, "block") == 0)
+                    logConfig.overflow = LOG_OVERFLOW_BLOCK;
+                else if (strcmp(optarg, "drop-newest") == 0)
+                    logConfig.overflow = LOG_OVERFLOW_DROP_NEWEST;
+                else if (strcmp(optarg, "overwrite-oldest") == 0)
+                    logConfig.overflow = LOG_OVERFLOW_OVERWRITE_OLDEST;
+                else {
+                    printf("Unknown overflow policy: %s (block, drop-newest, overwrite-oldest)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                if (strcmp(optarg, "write") == 0)
+                    logConfig.backend = LOG_BACKEND_WRITE;
+                else if (strcmp(optarg, "mmap") == 0)
+                    logConfig.backend = LOG_BACKEND_MMAP;
+                else if (strcmp(optarg, "io_uring") == 0)
+                    logConfig.backend = LOG_BACKEND_URING;
+                else {
+                    printf("Unknown log backend: %s (write, mmap, io_uring)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "none") == 0)
+                    logConfig.sync = LOG_SYNC_NONE;
+                else if (strcmp(optarg, "entries") == 0)
+                    logConfig.sync = LOG_SYNC_ENTRIES;
+                else if (strcmp(optarg, "interval") == 0)
+                    logConfig.sync = LOG_SYNC_INTERVAL;
+                else if (strcmp(optarg, "complete") == 0)
+                    logConfig.sync = LOG_SYNC_COMPLETE;
+                else {
+                    printf("Unknown log sync policy: %s (none, entries, interval, complete)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                logConfig.syncEvery = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                wheelCount = atoi(optarg);
+                if (wheelCount < 1 || wheelCount > MAX_NUM_WHEELS) {
+                    printf("Wheel count must be between 1 and %d\n", MAX_NUM_WHEELS);
+                    return 1;
+                }
+#ifdef SCENARIO_BENCH
+                wheelsGiven = 1;
+#endif
+                break;
+            case 'S':
+                batchType = parseScenarioType(optarg);
+                if (batchType < 0) {
+                    printf("Unknown scenario: %s (rock, sink, free, multi)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                runs = atoi(optarg);
+                if (runs < 1) {
+                    printf("Run count must be at least 1\n");
+                    return 1;
+                }
+                break;
+            case 'd':
+                masterSeed = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                cycleMs = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                if (strcmp(optarg, "real") == 0)
+                    clockMode = REAL_TIME;
+                else if (strcmp(optarg, "virtual") == 0)
+                    clockMode = VIRTUAL_TIME;
+                else {
+                    printf("Unknown clock: %s (real, virtual)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                if (strcmp(optarg, "threads") == 0)
+                    executorMode = THREADS;
+                else if (strcmp(optarg, "tasks") == 0)
+                    executorMode = TASKS;
+                else if (strcmp(optarg, "fibers") == 0)
+                    executorMode = FIBERS;
+                else {
+                    printf("Unknown executor: %s (threads, tasks, fibers)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':
+                if (barrier_parse_type(optarg, &barrierType) != 0) {
+                    printf("Unknown barrier: %s (pthread, central, dissemination)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'R':
+                recordPath = optarg;
+                break;
+            case 'J':
+                resultsPath = optarg;
+                break;
+            case 'F':
+                if (results_parse_format(optarg, &resultsFormat) != 0) {
+                    printf("Unknown results format: %s (jsonl, csv)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (trace_load(&replayTrace, optarg) != 0) {
+                    printf("Could not read trace: %s\n", optarg);
+                    return 1;
+                }
+                replaying = 1;
+                break;
+            case 'W':
+                workers = atoi(optarg);
+                if (workers < 1) {
+                    printf("Worker count must be at least 1\n");
+                    return 1;
+                }
+                break;
+            case 'v':
+                solvers = atoi(optarg);
+                if (solvers < 1) {
+                    printf("Solver count must be at least 1\n");
+                    return 1;
+                }
+                break;
+            case 'N':
+                firstRun = atoi(optarg);
+                if (firstRun < 0) {
+                    printf("First run must be at least 0\n");
+                    return 1;
+                }
+                break;
+            case 'j':
+                concurrency = atoi(optarg);
+                if (concurrency < 1) {
+                    printf("Concurrency must be at least 1\n");
+                    return 1;
+                }
+                break;
+            default:
+                printf("Usage: %s [--log-capacity N] [--binary-log] [--log-level LEVEL]\n"
+                       "          [--console full|summary|off] [--console-rate LINES_PER_SEC]\n"
+                       "          [--log-overflow block|drop-newest|overwrite-oldest]\n"
+                       "          [--log-backend write|mmap|io_uring]\n"
+                       "          [--log-sync none|entries|interval|complete] [--log-sync-every N]\n"
+                       "          [--wheels N] [--cycle-ms MS] [--clock real|virtual]\n"
+                       "          [--executor threads|tasks|fibers] [--workers N] [--solvers N]\n"
+                       "          [--barrier pthread|central|dissemination]\n"
+                       "          [--record FILE | --replay FILE] [--results FILE [--results-format jsonl|csv]]\n"
+                       "          [--scenario rock|sink|free|multi [--runs N] [--seed S] [--first-run N] [--jobs K]]\n", argv[0]);
+                return 1;
+        }
+    }
 
-char* generateFileName(scenario_type scType);
-char *getLogNameForProblemType(wheel_state pType);
+    // A replay runs the traced scenario once, with the transitions in their recorded order.
+    if (replaying) {
+        if (recordPath != NULL || executorMode == TASKS) {
+            printf("--replay needs --executor threads or fibers, and no --record\n");
+            return 1;
+        }
+        batchType = (int)replayTrace.header.type;
+        wheelCount = (int)replayTrace.header.wheels;
+        runs = 1;
+        concurrency = 1;
+    }
 
-int processWheelState(wheel_t *wheel, scenario_t *scenario);
-void waitForContinueSignal(wheel_t *wheel, scenario_t *scenario);
+    if (resultsPath != NULL && results_open(&results, resultsPath, resultsFormat) != 0) {
+        printf("Could not open results file: %s\n", resultsPath);
+        return 1;
+    }
 
-/*
- * main
- * Shows menu, handles input & starts scenarios*/
-int main() {
-    srand((unsigned)time(NULL));
-    pthread_t menuThread;
+    if (executorMode != THREADS) {
+        if (workers == 0)
+            workers = executor_default_workers();
+        if (executor_init(&executor, workers) != 0) {
+            printf("ERROR(executor_init); could not start %d workers\n", workers);
+            return 1;
+        }
+    }
+    if (dispatcher_init(&dispatcher, solvers, executorMode != THREADS ? &executor : NULL) != 0) {
+        printf("ERROR(dispatcher_init); could not start %d solvers\n", solvers);
+        return 1;
+    }
+#ifdef SCENARIO_BENCH
+    status = benchSweep(batchType, runs > 0 ? runs : BENCH_RUNS, concurrency, wheelsGiven ? wheelCount : 0);
+#else
+    if (batchType >= 0) {
+        status = runBatch((scenario_type)batchType, runs > 0 ? runs : 1, concurrency);
+        if (replaying) {
+            printf("Replayed %zu of %zu trace records\n", replayTrace.cursor, replayTrace.count);
+            trace_free(&replayTrace);
+        }
+    }
+    else {
+        pthread_t menuThread;
 
-    // Kick off menu thread
-    pthread_create(&menuThread, NULL, menuLoop, NULL);
-    pthread_join(menuThread, NULL);
+        // Kick off menu thread
+        pthread_create(&menuThread, NULL, menuLoop, NULL);
+        pthread_join(menuThread, NULL);
 
-    printf("\nPress any key to exit. \n");
-    getchar();
+        printf("\nPress any key to exit. \n");
+        getchar();
+        status = 0;
+    }
+#endif
+#ifdef SYNC_STATS
+    sync_stats_report(&dispatcher.mutex.stats, stdout);
+    sync_stats_report(&dispatcher.work_condition.stats, stdout);
+#endif
+    dispatcher_destroy(&dispatcher);
+    if (resultsPath != NULL)
+        results_close(&results);
+    if (executorMode != THREADS) {
+        executor_destroy(&executor);
+    }
+    return status;
+}
+
+#ifdef SCENARIO_BENCH
+/*
+ * Function: benchSweep
+ * --------------------------
+ * bench_scenario's main: runs a batch for each scenario type (or just
+ * type, if >= 0) at 6, 64 and 1024 wheels (or just wheels, if > 0), and
+ * prints the cycle, problem resolution and wake-up latency histograms
+ * of each. The clock defaults to virtual, so cycles are measured without
+ * the pause between them; with --clock real they include cycleMs.
+ *
+ * returns: 0, or 1 if a batch failed to run.
+ * */
+int benchSweep(int type, int runs, int concurrency, int wheels) {
+    static const int sweepWheels[] = {6, 64, 1024};
+    for (int t = ROCK_1; t <= MULTI; t++) {
+        if (type >= 0 && t != type)
+            continue;
+        for (int i = 0; i < (int)(sizeof(sweepWheels) / sizeof(sweepWheels[0])); i++) {
+            if (wheels > 0 && i > 0)
+                break;
+            wheelCount = wheels > 0 ? wheels : sweepWheels[i];
+            hist_reset(&cycleLatency);
+            hist_reset(&resolveLatency);
+            hist_reset(&wakeLatency);
+            if (runBatch((scenario_type)t, runs, concurrency) != 0)
+                return 1;
+            if (clockMode == VIRTUAL_TIME)
+                printf("Latency: %s, %d wheels, virtual clock\n", scenarioTypeNames[t], wheelCount);
+            else
+                printf("Latency: %s, %d wheels, real clock (%u ms pause per cycle)\n",
+                       scenarioTypeNames[t], wheelCount, cycleMs);
+            hist_print(&cycleLatency, "cycle", stdout);
+            hist_print(&resolveLatency, "resolve", stdout);
+            hist_print(&wakeLatency, "wake-up", stdout);
+        }
+    }
     return 0;
 }
+#endif
+
+// Returns the scenario_type called name (or its menu number), or -1.
+int parseScenarioType(const char *name) {
+    if (strcmp(name, "rock") == 0 || strcmp(name, "1") == 0)
+        return ROCK_1;
+    if (strcmp(name, "sink") == 0 || strcmp(name, "2") == 0)
+        return SINK_1;
+    if (strcmp(name, "free") == 0 || strcmp(name, "3") == 0)
+        return FREE_1;
+    if (strcmp(name, "multi") == 0 || strcmp(name, "4") == 0)
+        return MULTI;
+    return -1;
+}
+
+/*
+ * Function: runBatch
+ * --------------------------
+ * Headless mode. Runs the scenario runs times, at most concurrency at
+ * once, each with its own scenario_t, logger threads and log file.
+ * Results are collected as scenarios finish; at the end it prints
+ * scenario and cycle throughput and the pass/fail counts.
+ *
+ * returns: 0, or 1 if a scenario thread could not be started.
+ * */
+int runBatch(scenario_type type, int runs, int concurrency) {
+    if (concurrency > runs)
+        concurrency = runs;
+    scenario_job_t *jobs = calloc(concurrency, sizeof(scenario_job_t));
+    int *active = calloc(concurrency, sizeof(int));
+    int *finished = calloc(concurrency, sizeof(int)); // Snapshot of jobs[i].finished, taken under batch.mutex.
+    if (jobs == NULL || active == NULL || finished == NULL) {
+        printf("ERROR(runBatch); could not allocate %d job slots\n", concurrency);
+        return 1;
+    }
+    batch_t batch;
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done_condition, NULL);
+
+    int started = 0;
+    int collected = 0;
+    int running = 0;
+    int passed = 0;
+    int failed = 0;
+    int status = 0;
+    unsigned long cycles = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (collected < started || started < runs) {
+        // Fill every free slot.
+        for (int i = 0; i < concurrency && started < runs && status == 0; i++) {
+            if (active[i])
+                continue;
+            scenario_job_t *job = &jobs[i];
+            job->type = type;
+            job->run = firstRun + started;
+            job->batch = &batch;
+            job->finished = 0;
+            int rc = pthread_create(&job->thread, NULL, scenario_create, (void *)job);
+            if (rc) {
+                printf("ERROR(scenario_create); return code from pthread_create() is %d\n", rc);
+                status = 1;
+                break;
+            }
+            active[i] = 1;
+            running++;
+            started++;
+        }
+        if (running == 0)
+            break;
+
+        // Wait for at least one scenario to finish, then collect every finished one.
+        pthread_mutex_lock(&batch.mutex);
+        int done = 0;
+        while (done == 0) {
+            for (int i = 0; i < concurrency; i++) {
+                finished[i] = active[i] && jobs[i].finished;
+                done += finished[i];
+            }
+            if (done == 0)
+                pthread_cond_wait(&batch.done_condition, &batch.mutex);
+        }
+        pthread_mutex_unlock(&batch.mutex);
+
+        for (int i = 0; i < concurrency; i++) {
+            if (!finished[i])
+                continue;
+            pthread_join(jobs[i].thread, NULL);
+            active[i] = 0;
+            running--;
+            collected++;
+            cycles += jobs[i].cycles;
+            if (jobs[i].outcome == PASSED)
+                passed++;
+            else
+                failed++;
+            printf("Run %d: %s after %u cycles\n", jobs[i].run,
+                   jobs[i].outcome == PASSED ? "PASSED" : "FAILED", jobs[i].cycles);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Batch: %d runs (%d at a time), %d wheels, %.3f s: %.2f scenarios/s, %.2f cycles/s, %d passed, %d failed\n",
+           collected, concurrency, wheelCount, elapsed, elapsed > 0 ? collected / elapsed : 0.0,
+           elapsed > 0 ? cycles / elapsed : 0.0, passed, failed);
+    printf("Seed: %llu (pass --seed %llu to repeat these runs)\n", (unsigned long long)masterSeed,
+           (unsigned long long)masterSeed);
+
+    pthread_cond_destroy(&batch.done_condition);
+    pthread_mutex_destroy(&batch.mutex);
+    free(jobs);
+    free(active);
+    free(finished);
+    return status;
+}
 
 void *menuLoop() {
-    scenario_type type;
+    scenario_job_t job;
     pthread_t scenarioThread;
     int scenarioRetVal;
     void *scenarioStatus;
@@ -152,16 +750,16 @@ void *menuLoop() {
         scanf(" %c", &menuKeypress);
         switch (menuKeypress) {
             case '1':
-                type = ROCK_1;
+                job.type = ROCK_1;
                 break;
             case '2':
-                type = SINK_1;
+                job.type = SINK_1;
                 break;
             case '3':
-                type = FREE_1;
+                job.type = FREE_1;
                 break;
             case '4':
-                type = MULTI;
+                job.type = MULTI;
                 break;
             case 'Q':
                 exitFlag = 1;
@@ -172,7 +770,9 @@ void *menuLoop() {
         }
 
         // Start the Scenario
-        scenarioRetVal = pthread_create(&scenarioThread, NULL, scenario_create, (void *)type);
+        job.run = -1;
+        job.batch = NULL;
+        scenarioRetVal = pthread_create(&scenarioThread, NULL, scenario_create, (void *)&job);
         if (scenarioRetVal) {
             printf("ERROR(scenario_create); return code from pthread_create() is %d\n", scenarioRetVal);
         }
@@ -189,404 +789,735 @@ void *menuLoop() {
 }
 
 void *scenario_create(void *args) {
-    scenario_type scType = (scenario_type)args;
+    scenario_job_t *job = (scenario_job_t *)args;
 
     // Initialize Scenario Data
-    scenario_t scenario = scenario_init(scType);
+    scenario_t scenario;
+    scenario_init(&scenario, job->type, wheelCount, job->run);
 
     // Run the scenario.
     scenario_run(&scenario);
+    job->outcome = scenario.outcome;
+    job->cycles = scenario.cycle;
+    if (scenario.tracing == RECORDING) {
+        char path[PATH_MAX];
+        if (job->run >= 0)
+            snprintf(path, sizeof(path), "%s.%d", recordPath, job->run);
+        else
+            snprintf(path, sizeof(path), "%s", recordPath);
+        if (trace_save(scenario.trace, path) == 0)
+            printf("Trace: %zu records in %s\n", scenario.trace->count, path);
+        else
+            printf("ERROR(trace_save); could not write %s\n", path);
+    }
+
+    if (resultsPath != NULL && writeResult(&scenario, job->run) != 0)
+        printf("ERROR(writeResult); could not append run %d to %s\n", job->run, resultsPath);
 
     // Clean up my mess
     scenario_destroy(&scenario);
+
+    // Hand the result to the batch runner.
+    if (job->batch != NULL) {
+        pthread_mutex_lock(&job->batch->mutex);
+        job->finished = 1;
+        pthread_cond_signal(&job->batch->done_condition);
+        pthread_mutex_unlock(&job->batch->mutex);
+    }
     pthread_exit(0);
 }
 
-scenario_t scenario_init(scenario_type scType) {
-    scenario_t scenario;
-
-    scenario.type = scType;
+void scenario_init(scenario_t *scenario, scenario_type scType, int numWheels, int run) {
+    scenario->type = scType;
 
     // Set counters & flags
-    scenario.totalDistanceVectored = 0;
-    scenario.solvedProblemCount = 0;
-    scenario.currentCycleProblems = 0;
-    scenario.multiReset = 0;
+    scenario->totalDistanceVectored = 0;
+    atomic_init(&scenario->solvedProblemCount, 0);
+    atomic_init(&scenario->currentCycleProblems, 0);
+    scenario->multiReset = 0;
+    scenario->cycle = 0;
+    scenario->finished = 0;
+    scenario->outcome = PASSED;
+    atomic_init(&scenario->simTime, 0);
+
+    // Batch runs are streams 0 to runs - 1 of the master seed; menu runs follow on from 2^32.
+    static atomic_uint menuRuns;
+    uint64_t stream = run >= 0 ? (uint64_t)run : (1ull << 32) + atomic_fetch_add(&menuRuns, 1);
+    scenario->seed = rng_derive(masterSeed, stream);
+    rng_seed(&scenario->solveRng, scenario->seed, 0);
+
+    scenario->tracing = NO_TRACE;
+    scenario->trace = NULL;
+    if (replaying) {
+        scenario->tracing = REPLAYING;
+        scenario->trace = &replayTrace;
+        replayTrace.cursor = 0;
+    }
+    else if (recordPath != NULL) {
+        scenario->tracing = RECORDING;
+        scenario->trace = malloc(sizeof(trace_t));
+        if (scenario->trace == NULL || trace_init(scenario->trace, scType, numWheels, scenario->seed) != 0) {
+            printf("ERROR(scenario_init); could not allocate the trace\n");
+            exit(-1);
+        }
+    }
 
     // Init scenario state
-    scenario.state = SETUP;
+    atomic_init(&scenario->state, SETUP);
 
     // Setup Logging utility
-    scenario.log = log_init(scType);
+    generateFileName(scType, run, scenario->logFileName, sizeof(scenario->logFileName));
+    if (log_init(&scenario->log, scenario->logFileName, &logConfig) != 0) {
+        printf("ERROR(log_init); could not allocate log ring\n");
+        exit(-1);
+    }
+    if (clockMode == VIRTUAL_TIME) {
+        scenario->log.clock = &scenario->simTime;
+    }
 
-    // Initialize wheel id & states
-    for (int i = 0; i < NUM_WHEELS; i++) {
-        scenario.wheels[i].id = i;
-        scenario.wheels[i].state = WORKING;
+    // Allocate & initialize wheel states
+    wheel_set_t *wheels = &scenario->wheels;
+    wheels->count = numWheels;
+    wheels->state = malloc(numWheels * sizeof(*wheels->state));
+    wheels->threads = malloc(numWheels * sizeof(pthread_t));
+    wheels->threadData = malloc(numWheels * sizeof(scenario_wheel_t));
+    wheels->problems = malloc(numWheels * sizeof(dispatch_item_t));
+    if (wheels->state == NULL || wheels->threads == NULL || wheels->threadData == NULL || wheels->problems == NULL) {
+        printf("ERROR(scenario_init); could not allocate %d wheels\n", numWheels);
+        exit(-1);
+    }
+    for (int i = 0; i < numWheels; i++) {
+        atomic_init(&wheels->state[i], WORKING);
+        wheels->threadData[i].scenario = scenario;
+        wheels->threadData[i].wheel = i;
+        wheels->problems[i].solve = solveProblem;
+        wheels->problems[i].arg = scenario;
+        wheels->problems[i].wheel = i;
     }
 
-    // Init pthread vars
-    pthread_mutex_init(&scenario.mutex, NULL);
-    pthread_cond_init(&scenario.problem_condition, NULL);
-    pthread_cond_init(&scenario.continue_condition, NULL);
-    pthread_cond_init(&scenario.scenarioComplete_condition, NULL);
-    pthread_barrier_init(&scenario.wheelSetup_barrier, NULL, NUM_WHEELS);
-    pthread_barrier_init(&scenario.solutionSetup_barrier, NULL, 4);
-    pthread_barrier_init(&scenario.wheelCycle_barrier, NULL, NUM_WHEELS + 1);
-    pthread_cond_init(&scenario.conditions.sinking_condition, NULL);
-    pthread_cond_init(&scenario.conditions.freeWheeling_condition, NULL);
-    pthread_cond_init(&scenario.conditions.blocked_condition, NULL);
+    scenario->bodies = calloc(SCENARIO_BODIES(numWheels), sizeof(scenario_body_t));
+    if (scenario->bodies == NULL) {
+        printf("ERROR(scenario_init); could not allocate %d thread records\n", SCENARIO_BODIES(numWheels));
+        exit(-1);
+    }
+    memset(scenario->handlerUsage, 0, sizeof(scenario->handlerUsage));
+
+    scenario->cycleTimes = NULL;
+    scenario->resolveTimes = NULL;
+    if (resultsPath != NULL) {
+        scenario->cycleTimes = malloc(sizeof(hist_t));
+        scenario->resolveTimes = malloc(sizeof(hist_t));
+        if (scenario->cycleTimes == NULL || scenario->resolveTimes == NULL) {
+            printf("ERROR(scenario_init); could not allocate the latency histograms\n");
+            exit(-1);
+        }
+        hist_reset(scenario->cycleTimes);
+        hist_reset(scenario->resolveTimes);
+    }
+
+    // Tasks replace the wheel, handler and monitor threads.
+    scenario->executor = executorMode == TASKS ? &executor : NULL;
+    wheels->tasks = NULL;
+    scenario->deferred = NULL;
+    scenario->deferredCount = 0;
+    if (scenario->executor != NULL) {
+        wheels->tasks = malloc(numWheels * sizeof(executor_task_t));
+        scenario->deferred = malloc(numWheels * sizeof(int));
+        if (wheels->tasks == NULL || scenario->deferred == NULL) {
+            printf("ERROR(scenario_init); could not allocate %d wheel tasks\n", numWheels);
+            exit(-1);
+        }
+        for (int i = 0; i < numWheels; i++) {
+            wheels->tasks[i].fn = wheelCycleTask;
+            wheels->tasks[i].arg = &wheels->threadData[i];
+        }
+        scenario->cycleTask.fn = cycleStartTask;
+        scenario->cycleTask.arg = scenario;
+        scenario->monitorTask.fn = monitorStepTask;
+        scenario->monitorTask.arg = scenario;
+    }
+
+    // Fibers take their stacks from one reservation, so large fleets need a single mapping.
+    scenario->fibers = NULL;
+    scenario->fiberStacks = NULL;
+    scenario->fiberStacksSize = 0;
+    if (executorMode == FIBERS) {
+        scenario->fibers = calloc(SCENARIO_FIBERS(numWheels), sizeof(fiber_t));
+        scenario->fiberStacksSize = (size_t)SCENARIO_FIBERS(numWheels) * WHEEL_STACK_SIZE;
+        scenario->fiberStacks = mmap(NULL, scenario->fiberStacksSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (scenario->fibers == NULL || scenario->fiberStacks == MAP_FAILED) {
+            printf("ERROR(scenario_init); could not allocate %d wheel fibers\n", numWheels);
+            exit(-1);
+        }
+    }
 
-    return scenario;
+    // Init sync vars (fiber-aware with FIBERS)
+    int fibers = executorMode == FIBERS;
+    sync_mutex_init(&scenario->mutex, fibers);
+    sync_cond_init(&scenario->problem_condition, fibers);
+    sync_cond_init(&scenario->continue_condition, fibers);
+    sync_cond_init(&scenario->scenarioComplete_condition, fibers);
+    sync_cond_init(&scenario->turn_condition, fibers);
+    barrier_type barriers = executorMode == THREADS ? barrierType : BARRIER_PTHREAD; // Unused with TASKS.
+    if (sync_barrier_init(&scenario->wheelSetup_barrier, fibers, barriers, numWheels) != 0
+        || sync_barrier_init(&scenario->wheelCycle_barrier, fibers, barriers, numWheels + 1) != 0) {
+        printf("ERROR(scenario_init); could not create %s barriers\n", barrier_type_name(barrierType));
+        exit(-1);
+    }
 }
 
 int scenario_run(scenario_t *scenario) {
 
     pthread_t fLoggerThread; // File Logger Thread
-    pthread_t sinkT, blockT, freeT; // Problem handler Threads
-    pthread_t vMT; // Vector Monitor Thread
+    pthread_t cLoggerThread; // Console Logger Thread
+    uint64_t start = hist_now();
 
     printf("Starting File Logger\n");
-    pthread_create(&fLoggerThread, NULL, log_consume, (void *)&scenario->log);
+    scenario_body_t *loggers = &scenario->bodies[scenario->wheels.count + 1];
+    loggers[0].fn = log_consume;
+    loggers[0].arg = &scenario->log;
+    loggers[1].fn = log_console_consume;
+    loggers[1].arg = &scenario->log;
+    pthread_create(&fLoggerThread, NULL, accountedBody, &loggers[0]);
+    pthread_create(&cLoggerThread, NULL, accountedBody, &loggers[1]);
     printf("Logging to: %s\n", scenario->log.fileName);
 
-    log_print(&scenario->log, "Starting Solution Threads\n");
-    pthread_create(&sinkT, NULL, sinkProblemHandler, (void *)scenario);
-    pthread_create(&freeT, NULL, freeWheelProblemHandler, (void *)scenario);
-    pthread_create(&blockT, NULL, blockProblemHandler, (void *)scenario);
+    if (scenario->executor != NULL)
+        scenarioRunTasks(scenario);
+    else
+        scenarioRunThreads(scenario);
 
-    // Wait for solution handlers to be ready.
-    pthread_barrier_wait(&scenario->solutionSetup_barrier);
+    // Logger drains whatever is left in the ring before exiting.
+    log_close(&scenario->log);
+    //printf("Waiting for logger to end\n");
+    pthread_join(fLoggerThread, NULL);
+    pthread_join(cLoggerThread, NULL);
+    scenario->wallNs = hist_now() - start;
+    log_report(&scenario->log, stdout);
+    reportUsage(scenario, stdout);
+#ifdef SYNC_STATS
+    // Every wheel and the monitor have finished, so the counters are final.
+    sync_stats_report(&scenario->mutex.stats, stdout);
+    sync_stats_report(&scenario->continue_condition.stats, stdout);
+    sync_stats_report(&scenario->problem_condition.stats, stdout);
+    sync_stats_report(&scenario->scenarioComplete_condition.stats, stdout);
+    sync_stats_report(&scenario->turn_condition.stats, stdout);
+    sync_stats_report(&scenario->wheelSetup_barrier.stats, stdout);
+    sync_stats_report(&scenario->wheelCycle_barrier.stats, stdout);
+#endif
+    return 0;
+}
 
-    pthread_mutex_lock(&scenario->mutex);
-    scenario->state = VECTORING;
-    pthread_mutex_unlock(&scenario->mutex);
+/*
+ * Function: scenarioRunThreads
+ * --------------------------
+ * Runs the scenario with a thread (or with FIBERS, a fiber) per wheel
+ * and the monitor, and returns once they have all exited. Problems go
+ * to the shared dispatcher.
+ * */
+void scenarioRunThreads(scenario_t *scenario) {
+    pthread_t vMT; // Vector Monitor Thread
+    wheel_set_t *wheels = &scenario->wheels;
+
+    sync_mutex_lock(&scenario->mutex);
+    solutionsStarting(scenario);
+    setScenarioState(scenario, LOG_NO_WHEEL, VECTORING);
+    scenario->cycleStartNs = hist_now();
+    sync_mutex_unlock(&scenario->mutex);
 
     // Start VectorMonitor (Updates total distance travelled)
-    log_print(&scenario->log, "Starting VectorMonitor\n");
-    pthread_create(&vMT, NULL, scenarioMonitor, (void *)scenario);
+    scenarioLog(scenario, EV_MONITOR_STARTING, LOG_NO_WHEEL, HANDLER_NONE, 0);
+    bodyStart(scenario, &vMT, wheels->count, scenarioMonitor, (void *)scenario, NULL);
 
     // Start wheel threads
-    pthread_t wheelThreads[NUM_WHEELS];
-    scenario_wheel_t threadDataArr[NUM_WHEELS];
-    for (int i =0; i < NUM_WHEELS; i++) {
-        threadDataArr[i].scenario = scenario;
-        threadDataArr[i].wheel = &scenario->wheels[i];
-        pthread_create(&wheelThreads[i], NULL, wheel_start, (void *)&threadDataArr[i]);
+    pthread_attr_t wheelAttr;
+    pthread_attr_init(&wheelAttr);
+    pthread_attr_setstacksize(&wheelAttr, WHEEL_STACK_SIZE);
+    for (int i = 0; i < wheels->count; i++) {
+        bodyStart(scenario, &wheels->threads[i], i, wheel_start, (void *)&wheels->threadData[i], &wheelAttr);
     }
+    pthread_attr_destroy(&wheelAttr);
 
     // Wait for the Scenario to Finish.
     // This could also be achieved by doing a pthread_join() on each wheel thread?
 
-    pthread_mutex_lock(&scenario->mutex);
+    sync_mutex_lock(&scenario->mutex);
     while(scenario->state != COMPLETE) {
-        pthread_cond_wait(&scenario->scenarioComplete_condition, &scenario->mutex);
-        pthread_mutex_unlock(&scenario->mutex);
-    }
-    log_print(&scenario->log, "SCENARIO_COMPLETED\n");
-    for (int i = 0; i < NUM_WHEELS; i++) {
-        pthread_join(wheelThreads[i], NULL);
-    }
-    // Ensure all threads are destroyed before exiting this scenario.
-    // Signal the problem handler threads once more
-    // This allows them to exit gracefully.
-    pthread_cond_signal(&scenario->conditions.blocked_condition);
-    pthread_cond_signal(&scenario->conditions.sinking_condition);
-    pthread_cond_signal(&scenario->conditions.freeWheeling_condition);
-
-    //printf("Attemping to close threads\n");
-   // printf("Waiting for sinker to end\n");
-    pthread_join(sinkT, NULL);
-    //printf("Waiting for blockH to end\n");
-    pthread_join(blockT, NULL);
-   // printf("Waiting for freeH to end\n");
-    pthread_join(freeT, NULL);
-
-    scenario->log.close = 1;
-    pthread_cond_broadcast(&scenario->log.new_data_cond);
-    //printf("Waiting for logger to end\n");
-    pthread_join(fLoggerThread, NULL);
+        sync_cond_wait(&scenario->scenarioComplete_condition, &scenario->mutex);
+    }
+    sync_mutex_unlock(&scenario->mutex);
+    scenarioLog(scenario, EV_SCENARIO_COMPLETED, LOG_NO_WHEEL, HANDLER_NONE, 0);
+    for (int i = 0; i < wheels->count; i++) {
+        bodyJoin(scenario, &wheels->threads[i], i);
+    }
 
    // printf("Waiting for scenMon to end\n");
-    pthread_join(vMT, NULL);
-    return 0;
+    bodyJoin(scenario, &vMT, wheels->count);
+}
+
+/*
+ * Logs the solutions starting and each problem type's handler waiting,
+ * as the per-scenario handler threads once did. Called with the mutex held.
+ * */
+void solutionsStarting(scenario_t *scenario) {
+    scenarioLog(scenario, EV_SOLUTIONS_STARTING, LOG_NO_WHEEL, HANDLER_NONE, 0);
+    scenarioLog(scenario, EV_HANDLER_WAITING, LOG_NO_WHEEL, HANDLER_SINK, 0);
+    scenarioLog(scenario, EV_HANDLER_WAITING, LOG_NO_WHEEL, HANDLER_FREE, 0);
+    scenarioLog(scenario, EV_HANDLER_WAITING, LOG_NO_WHEEL, HANDLER_BLOCK, 0);
+}
+
+/*
+ * Function: bodyStart
+ * --------------------------
+ * Starts fn(arg) on a thread, or with FIBERS on fiber slot fiber of the
+ * scenario, with its share of the fiber stacks. Exits on failure.
+ * */
+void bodyStart(scenario_t *scenario, pthread_t *thread, int fiber, void *(*fn)(void *), void *arg,
+               pthread_attr_t *attr) {
+    if (scenario->fibers != NULL) {
+        fiber_start(&scenario->fibers[fiber], &executor, fn, arg,
+                    scenario->fiberStacks + (size_t)fiber * WHEEL_STACK_SIZE, WHEEL_STACK_SIZE);
+        return;
+    }
+    scenario_body_t *body = &scenario->bodies[fiber];
+    body->fn = fn;
+    body->arg = arg;
+    int rc = pthread_create(thread, attr, accountedBody, body);
+    if (rc) {
+        printf("ERROR(bodyStart %d); return code from pthread_create() is %d\n", fiber, rc);
+        exit(-1);
+    }
+}
+
+// Thread entry: runs the body, then records what the thread used.
+void *accountedBody(void *args) {
+    scenario_body_t *body = (scenario_body_t *)args;
+    usage_mark_t start;
+    usage_mark(&start);
+    void *result = body->fn(body->arg);
+    usage_since(&body->usage, &start);
+    return result;
+}
+
+/*
+ * Function: reportUsage
+ * --------------------------
+ * Prints what the scenario's threads used: the wheels summed, the
+ * monitor, each handler's share of the solver threads and the loggers.
+ * Wheels, monitor and handlers are only threads with THREADS; fibers and
+ * tasks share the executor's workers, so only the loggers are shown.
+ * Call after every body has been joined.
+ * */
+void reportUsage(scenario_t *scenario, FILE *out) {
+    int count = scenario->wheels.count;
+    fprintf(out, "Threads:\n");
+    usage_report_header(out);
+    if (executorMode == THREADS) {
+        thread_usage_t wheels = {0};
+        for (int i = 0; i < count; i++)
+            usage_add(&wheels, &scenario->bodies[i].usage);
+        usage_report_row("wheels", &wheels, out);
+        usage_report_row("monitor", &scenario->bodies[count].usage, out);
+        for (log_handler h = HANDLER_SINK; h <= HANDLER_BLOCK; h++)
+            usage_report_row(log_handler_name(h), &scenario->handlerUsage[h - HANDLER_SINK], out);
+    }
+    usage_report_row("file logger", &scenario->bodies[count + 1].usage, out);
+    usage_report_row("console logger", &scenario->bodies[count + 2].usage, out);
+}
+
+/*
+ * Function: writeResult
+ * --------------------------
+ * Appends the finished scenario's result record to the --results file.
+ *
+ * returns: 0, or -1 if the record could not be written.
+ * */
+int writeResult(scenario_t *scenario, int run) {
+    result_record_t rec;
+    rec.type = scenarioTypeNames[scenario->type];
+    rec.run = run;
+    rec.seed = masterSeed;
+    rec.wheels = scenario->wheels.count;
+    rec.executor = executorNames[executorMode];
+    rec.cycles = scenario->cycle;
+    rec.distance = scenario->totalDistanceVectored;
+    rec.outcome = scenario->outcome == PASSED ? "PASSED" : "FAILED";
+    rec.wallSec = (double)scenario->wallNs / 1e9;
+    rec.cycleP50Us = (double)hist_percentile(scenario->cycleTimes, 0.50) / 1e3;
+    rec.cycleP99Us = (double)hist_percentile(scenario->cycleTimes, 0.99) / 1e3;
+    rec.cycleMaxUs = (double)atomic_load(&scenario->cycleTimes->max) / 1e3;
+    rec.resolveP50Us = (double)hist_percentile(scenario->resolveTimes, 0.50) / 1e3;
+    rec.resolveP99Us = (double)hist_percentile(scenario->resolveTimes, 0.99) / 1e3;
+    rec.resolveMaxUs = (double)atomic_load(&scenario->resolveTimes->max) / 1e3;
+    return results_append(&results, &rec);
+}
+
+// Waits for a body started by bodyStart to return.
+void bodyJoin(scenario_t *scenario, pthread_t *thread, int fiber) {
+    if (scenario->fibers != NULL)
+        fiber_join(&scenario->fibers[fiber]);
+    else
+        pthread_join(*thread, NULL);
+}
+
+/*
+ * Function: scenarioRunTasks
+ * --------------------------
+ * Runs the scenario as tasks on the shared executor. Each cycle,
+ * cycleStartTask submits one task per wheel; the last wheel to finish
+ * submits monitorStepTask, which closes the cycle and schedules the next.
+ * A wheel that hits a problem reports it to the dispatcher and stays
+ * unfinished until it is solved; wheels arriving meanwhile are deferred
+ * and resumed by solveProblem, as wheel threads would wait on
+ * continue_condition.
+ * Returns once the monitor has flagged the scenario finished.
+ * */
+void scenarioRunTasks(scenario_t *scenario) {
+    sync_mutex_lock(&scenario->mutex);
+    solutionsStarting(scenario);
+    setScenarioState(scenario, LOG_NO_WHEEL, VECTORING);
+    scenario->cycleStartNs = hist_now();
+    scenario->pendingWheels = scenario->wheels.count;
+    sync_mutex_unlock(&scenario->mutex);
+
+    scenarioLog(scenario, EV_MONITOR_STARTING, LOG_NO_WHEEL, HANDLER_NONE, 0);
+    executor_submit(scenario->executor, &scenario->cycleTask);
+
+    sync_mutex_lock(&scenario->mutex);
+    while (!scenario->finished) {
+        sync_cond_wait(&scenario->scenarioComplete_condition, &scenario->mutex);
+    }
+    sync_mutex_unlock(&scenario->mutex);
+    scenarioLog(scenario, EV_SCENARIO_COMPLETED, LOG_NO_WHEEL, HANDLER_NONE, 0);
 }
 
 void scenario_destroy(scenario_t *scenario) {
 
     // Free pthread structs
-    pthread_mutex_destroy(&scenario->mutex);
-    pthread_cond_destroy(&scenario->problem_condition);
-    pthread_cond_destroy(&scenario->continue_condition);
-    pthread_cond_destroy(&scenario->scenarioComplete_condition);
-    pthread_cond_destroy(&scenario->conditions.sinking_condition);
-    pthread_cond_destroy(&scenario->conditions.freeWheeling_condition);
-    pthread_cond_destroy(&scenario->conditions.blocked_condition);
-    pthread_barrier_destroy(&scenario->wheelSetup_barrier);
-    pthread_barrier_destroy(&scenario->solutionSetup_barrier);
-    pthread_barrier_destroy(&scenario->wheelCycle_barrier);
+    sync_mutex_destroy(&scenario->mutex);
+    sync_cond_destroy(&scenario->problem_condition);
+    sync_cond_destroy(&scenario->continue_condition);
+    sync_cond_destroy(&scenario->scenarioComplete_condition);
+    sync_cond_destroy(&scenario->turn_condition);
+    sync_barrier_destroy(&scenario->wheelSetup_barrier);
+    sync_barrier_destroy(&scenario->wheelCycle_barrier);
 
     log_destroy(&scenario->log);
+    free(scenario->wheels.state);
+    free(scenario->bodies);
+    free(scenario->cycleTimes);
+    free(scenario->resolveTimes);
+    free(scenario->wheels.threads);
+    free(scenario->wheels.threadData);
+    free(scenario->wheels.problems);
+    free(scenario->wheels.tasks);
+    free(scenario->deferred);
+    if (scenario->tracing == RECORDING) {
+        trace_free(scenario->trace);
+        free(scenario->trace);
+    }
+    free(scenario->fibers);
+    if (scenario->fiberStacks != NULL)
+        munmap(scenario->fiberStacks, scenario->fiberStacksSize);
     return;
 }
 
 void *wheel_start(void *args) {
     scenario_wheel_t *threadData = (scenario_wheel_t *)args;
     scenario_t *scenario = threadData->scenario;
-    wheel_t *wheel = threadData->wheel;
-    shared_buffer_t *log = &scenario->log;
+    int wheel = threadData->wheel;
+    _Atomic(wheel_state) *state = &scenario->wheels.state[wheel];
     struct timespec ts;
-    ts.tv_nsec = 0;
-    ts.tv_sec = 1;
-    char msg[255];
+    ts.tv_nsec = (long)(cycleMs % 1000) * 1000000;
+    ts.tv_sec = cycleMs / 1000;
     // Synchronize first wheel run.
-    pthread_barrier_wait(&scenario->wheelSetup_barrier);
+    sync_barrier_wait(&scenario->wheelSetup_barrier, wheel);
     while(1) {
-        if(scenario->state == COMPLETE) {
-            break;
+        setWheelState(scenario, wheel, randomizeStateForScenario(scenario, wheel), 1);
+        if (*state == WORKING && scenario->state != PROBLEM) {
+            // Vectoring changes no scenario state, so it needs no lock.
+            if (isScenarioComplete(scenario) == 0)
+                processWheelState(wheel, scenario);
         }
-        pthread_mutex_lock(&scenario->mutex);
-        wheel->state = randomizeStateForScenario(scenario);
-        // Block while another problem is being solved.
-        waitForContinueSignal(wheel, scenario);
-
-        if (isScenarioComplete(scenario) == 0) { // Exit thread if complete.
-            // Vector or Signal problem.
-            processWheelState(wheel, scenario);
-
-            while (wheel->state != WORKING && scenario->state != VECTORING && scenario->state != COMPLETE) {
-                pthread_cond_wait(&scenario->continue_condition, &scenario->mutex);
+        else {
+            sync_mutex_lock(&scenario->mutex);
+            // Block while another problem is being solved.
+            waitForContinueSignal(wheel, scenario);
+
+            if (isScenarioComplete(scenario) == 0) { // Exit thread if complete.
+                // Vector or Signal problem. trySolveProblem sets the wheel
+                // WORKING without the mutex, so a reporting wheel waits for
+                // solveProblem to release the scenario, not for its own state.
+                if (processWheelState(wheel, scenario) != 0) {
+                    while (scenario->state == PROBLEM) {
+                        sync_cond_wait(&scenario->continue_condition, &scenario->mutex);
+                    }
+                }
             }
+            sync_mutex_unlock(&scenario->mutex);
+        }
+        sync_barrier_wait(&scenario->wheelCycle_barrier, wheel);
+        // The monitor closes the cycle between the two waits, so every wheel
+        // sees the same verdict and none is left behind at the barrier.
+        // (state itself may already be COMPLETE for the next cycle.)
+        sync_barrier_wait(&scenario->wheelCycle_barrier, wheel);
+        if (scenario->finished) {
+            break;
+        }
+        if (clockMode == REAL_TIME) {
+            sync_sleep(&ts); // Sleep for cycleMs (1 Sec by default) before continuing.
         }
-//        if(scenario->state == COMPLETE) {
-//            pthread_mutex_unlock(&scenario->mutex);
-//            break;
-//        }
-        pthread_mutex_unlock(&scenario->mutex);
-        pthread_barrier_wait(&scenario->wheelCycle_barrier);
-        nanosleep(&ts,NULL); // Sleep for 1 Sec before continuing.
 
     }
-    log_print(log, msg);
-    pthread_exit(NULL);
+    scenarioLog(scenario, EV_WHEEL_EXITING, wheel, HANDLER_NONE, 0);
     return NULL;
 }
 
-void waitForContinueSignal(wheel_t *wheel, scenario_t *scenario) {
-    shared_buffer_t *log = &scenario->log;
-    char msg[255];
+void waitForContinueSignal(int wheel, scenario_t *scenario) {
     while (scenario->state == PROBLEM & scenario->state != COMPLETE) {
-        sprintf(msg, "Wheel %d: Waiting for problems to be solved...\n", wheel->id);
-        log_print(log, msg);
-        pthread_cond_wait(&scenario->continue_condition, &scenario->mutex);
+        scenarioLog(scenario, EV_WHEEL_WAITING, wheel, HANDLER_NONE, 0);
+        sync_cond_wait(&scenario->continue_condition, &scenario->mutex);
+        if (scenario->state != PROBLEM)
+            BENCH_RECORD(wakeLatency, scenario->releaseNs);
     }
 }
 
-int processWheelState(wheel_t *wheel, scenario_t *scenario) {
-    shared_buffer_t *log = &scenario->log;
-    char msg[255];
-    switch(wheel->state) {
+// Logs the wheel vectoring, or raises its problem (with the mutex held).
+int processWheelState(int wheel, scenario_t *scenario) {
+    switch(scenario->wheels.state[wheel]) {
         case WORKING:
-            sprintf(msg, "Wheel %d: Vectoring...\n", wheel->id);
-            log_print(log, msg);
+            scenarioLog(scenario, EV_WHEEL_VECTORING, wheel, HANDLER_NONE, 0);
             return 0;
         case SINKING:
-            sprintf(msg, "Wheel %d: Sinking...\n", wheel->id);
-            log_print(log, msg);
-            scenario->currentCycleProblems +=1;
-            scenario->state = PROBLEM;
-            pthread_cond_signal(&scenario->conditions.sinking_condition);
+            scenarioLog(scenario, EV_WHEEL_SINKING, wheel, HANDLER_NONE, 0);
+            if (setScenarioState(scenario, wheel, PROBLEM) != 0)
+                return 0;
+            signalProblem(scenario, wheel, SINKING);
             return 1;
         case BLOCKED:
-            sprintf(msg, "Wheel %d: Blocked...\n", wheel->id);
-            log_print(log, msg);
-            scenario->currentCycleProblems += 1;
-            scenario->state = PROBLEM;
-            pthread_cond_signal(&scenario->conditions.blocked_condition);
+            scenarioLog(scenario, EV_WHEEL_BLOCKED, wheel, HANDLER_NONE, 0);
+            if (setScenarioState(scenario, wheel, PROBLEM) != 0)
+                return 0;
+            signalProblem(scenario, wheel, BLOCKED);
             return 2;
             break;
         case FREEWHEELING:
-            sprintf(msg, "Wheel %d: FreeWheeling...\n", wheel->id);
-            log_print(log, msg);
-            scenario->currentCycleProblems +=1;
-            scenario->state = PROBLEM;
-            pthread_cond_signal(&scenario->conditions.freeWheeling_condition);
+            scenarioLog(scenario, EV_WHEEL_FREEWHEELING, wheel, HANDLER_NONE, 0);
+            if (setScenarioState(scenario, wheel, PROBLEM) != 0)
+                return 0;
+            signalProblem(scenario, wheel, FREEWHEELING);
             return 3;
     }
 }
 
-void *sinkProblemHandler(void *args) {
-    scenario_t *scenario = (scenario_t *) args;
-    pthread_mutex_t *mutex = &scenario->mutex;
-    while (scenario->state != COMPLETE) {
-        pthread_mutex_lock(&scenario->mutex);
-        if (isScenarioComplete(scenario) == 1) {
-            printf("BlockHandler: Exiting\n");
-            pthread_mutex_unlock(mutex);
+/*
+ * Reports wheel's problem to the dispatcher, queued by type so that
+ * sinking wheels are served first, then blocked, then freewheeling ones.
+ * */
+void signalProblem(scenario_t *scenario, int wheel, wheel_state pType) {
+    dispatch_item_t *item = &scenario->wheels.problems[wheel];
+    scenario->problemNs = hist_now();
+    item->problem = pType;
+    switch (pType) {
+        case SINKING:
+            item->queue = 0;
             break;
-        }
-        if (scenario->state == SETUP) {
-            pthread_mutex_unlock(&scenario->mutex);
-            pthread_barrier_wait(&scenario->solutionSetup_barrier);
-            pthread_mutex_lock(&scenario->mutex);
-        }
-
-        log_print(&scenario->log, "SinkHandler: Waiting for signal...\n");
-        while(scenario->state != PROBLEM) {
-            pthread_cond_wait(&scenario->conditions.sinking_condition, &scenario->mutex);
-            if (scenario->state == COMPLETE) {
-                pthread_mutex_unlock(&scenario->mutex);
-                pthread_exit(NULL);
-            }
-        }
+        case BLOCKED:
+            item->queue = 1;
+            break;
+        default:
+            item->queue = 2;
+            break;
+    }
+    dispatcher_submit(&dispatcher, item);
+}
 
-        log_print(&scenario->log, "SinkHandler: Signal Received...\n");
-        for (int i = 0; i < NUM_WHEELS; i++) {
-            int result = trySolveProblem(scenario, &scenario->wheels[i], SINKING);
-            if (result == 1) {
-                log_print(&scenario->log, "Terminating Scenario...\n");
-                printf("FreeHandler: Exiting\n");
-                scenario->outcome = FAILED;
-                break;
-            }
-        }
-        scenario->state = scenario->outcome == FAILED ? COMPLETE: VECTORING;
-        log_print(&scenario->log, "SinkHandler: signaling & releasing lock...\n");
-        pthread_cond_broadcast(&scenario->continue_condition);
-        pthread_mutex_unlock(&scenario->mutex);
+/*
+ * Function: solveProblem
+ * --------------------------
+ * Dispatcher callback for one reported problem, in place of the sink,
+ * block and freeWheel handler threads. Only the reporting wheel is
+ * worked on, so the cost follows the number of problems rather than
+ * the number of wheels. Then releases the paused wheels: a broadcast
+ * on continue_condition, or with TASKS, finishing the reporting wheel's
+ * cycle and resuming the deferred ones.
+ * The wheel waits while its problem is solved, so only the release
+ * takes the mutex.
+ * */
+void solveProblem(dispatch_item_t *item) {
+    scenario_t *scenario = (scenario_t *)item->arg;
+    wheel_state pType = (wheel_state)item->problem;
+    log_handler handler = getHandlerForProblemType(pType);
+    usage_mark_t start;
+    if (executorMode == THREADS)
+        usage_mark(&start);
+    scenarioLog(scenario, EV_HANDLER_SIGNALLED, LOG_NO_WHEEL, handler, 0);
+    int failed = trySolveProblem(scenario, item->wheel, pType);
+
+    sync_mutex_lock(&scenario->mutex);
+    if (executorMode == THREADS)
+        usage_since(&scenario->handlerUsage[handler - HANDLER_SINK], &start);
+    if (failed) {
+        scenarioLog(scenario, EV_HANDLER_TERMINATE, LOG_NO_WHEEL, HANDLER_NONE, 0);
+        scenario->outcome = FAILED;
+    }
+    setScenarioState(scenario, item->wheel, scenario->outcome == FAILED ? COMPLETE: VECTORING);
+    scenarioLog(scenario, EV_HANDLER_RELEASING, LOG_NO_WHEEL, handler, 0);
+    if (scenario->state != COMPLETE) {
+        scenarioLog(scenario, EV_HANDLER_WAITING, LOG_NO_WHEEL, handler, 0);
+    }
+    scenario->releaseNs = hist_now();
+    BENCH_RECORD(resolveLatency, scenario->problemNs);
+    if (scenario->resolveTimes != NULL)
+        hist_record(scenario->resolveTimes, scenario->releaseNs - scenario->problemNs);
+
+    if (scenario->executor == NULL) {
+        sync_cond_broadcast(&scenario->continue_condition);
+        sync_mutex_unlock(&scenario->mutex);
+        return;
+    }
+    // Deferred wheels keep the cycle open, so the monitor cannot run before they are resumed.
+    int deferredCount = scenario->deferredCount;
+    scenario->deferredCount = 0;
+    wheelArrive(scenario);
+    for (int i = 0; i < deferredCount; i++) {
+        executor_task_t *wheelTask = &scenario->wheels.tasks[scenario->deferred[i]];
+        wheelTask->fn = wheelResumeTask;
+        executor_submit(scenario->executor, wheelTask);
+    }
+    sync_mutex_unlock(&scenario->mutex);
+}
 
+// Submits every wheel's task for the next cycle.
+void cycleStartTask(executor_task_t *task) {
+    scenario_t *scenario = (scenario_t *)task->arg;
+    executor_t *ex = scenario->executor;
+    executor_task_t *tasks = scenario->wheels.tasks;
+    int count = scenario->wheels.count; // The scenario may be gone after the last submit.
+    for (int i = 0; i < count; i++) {
+        tasks[i].fn = wheelCycleTask;
+        executor_submit(ex, &tasks[i]);
     }
-    pthread_exit(NULL);
 }
 
-void *blockProblemHandler(void *args) {
-    scenario_t *scenario = (scenario_t *) args;
-    while (scenario->state != COMPLETE) {
-        pthread_mutex_lock(&scenario->mutex);
-        if (isScenarioComplete(scenario) == 1) {
-            pthread_mutex_unlock(&scenario->mutex);
-            pthread_exit(NULL);
-        }
-        if (scenario->state == SETUP) {
-            pthread_mutex_unlock(&scenario->mutex);
-            pthread_barrier_wait(&scenario->solutionSetup_barrier);
-            pthread_mutex_lock(&scenario->mutex);
-        }
+// One wheel cycle: the body of the wheel_start loop up to the barrier.
+void wheelCycleTask(executor_task_t *task) {
+    scenario_wheel_t *data = (scenario_wheel_t *)task->arg;
+    scenario_t *scenario = data->scenario;
+    wheel_state state = setWheelState(scenario, data->wheel, randomizeStateForScenario(scenario, data->wheel), 1);
+    if (state == WORKING && scenario->state != PROBLEM) {
+        // As in wheel_start, vectoring needs no lock.
+        if (isScenarioComplete(scenario) == 0)
+            processWheelState(data->wheel, scenario);
+        wheelArrive(scenario);
+        return;
+    }
+    sync_mutex_lock(&scenario->mutex);
+    wheelProceed(scenario, data->wheel);
+    sync_mutex_unlock(&scenario->mutex);
+}
 
-        log_print(&scenario->log, "BlockHandler: waiting for signal...\n");
-        while(scenario->state != PROBLEM) {
-            pthread_cond_wait(&scenario->conditions.blocked_condition, &scenario->mutex);
-            if (scenario->state == COMPLETE) {
-                pthread_mutex_unlock(&scenario->mutex);
-                pthread_exit(NULL);
-            }
-        }
-        log_print(&scenario->log, "BlockHandler: Signal Received, searching for problem\n");
-        for (int i = 0; i < NUM_WHEELS; i++) {
-            int result = trySolveProblem(scenario, &scenario->wheels[i], BLOCKED);
-            if (result == 1) {
-                log_print(&scenario->log, "Terminating Scenario...\n");
-                scenario->state = COMPLETE;
-                scenario->outcome = FAILED;
-                break;
-            }
-        }
-        scenario->state = scenario->outcome == FAILED ? COMPLETE: VECTORING;
-        log_print(&scenario->log, "BlockHandler: signaling & releasing lock...\n");
-        pthread_cond_broadcast(&scenario->continue_condition);
-        pthread_mutex_unlock(&scenario->mutex);
+// Continues a cycle deferred by a problem, keeping the wheel's state.
+void wheelResumeTask(executor_task_t *task) {
+    scenario_wheel_t *data = (scenario_wheel_t *)task->arg;
+    scenario_t *scenario = data->scenario;
+    sync_mutex_lock(&scenario->mutex);
+    BENCH_RECORD(wakeLatency, scenario->releaseNs);
+    wheelProceed(scenario, data->wheel);
+    sync_mutex_unlock(&scenario->mutex);
+}
 
+/*
+ * Function: wheelProceed
+ * --------------------------
+ * Task counterpart of the waits in wheel_start. A wheel that finds a
+ * problem being solved is deferred; one that raises a problem stays
+ * unfinished until solveProblem releases it; any other wheel vectors and
+ * finishes the cycle. Called with the mutex held.
+ * */
+void wheelProceed(scenario_t *scenario, int wheel) {
+    if (scenario->state == PROBLEM) {
+        scenarioLog(scenario, EV_WHEEL_WAITING, wheel, HANDLER_NONE, 0);
+        scenario->deferred[scenario->deferredCount++] = wheel;
+        return;
+    }
+    if (isScenarioComplete(scenario) == 0 && processWheelState(wheel, scenario) != 0) {
+        return;
     }
-    pthread_exit(NULL);
+    wheelArrive(scenario);
 }
 
-void *freeWheelProblemHandler(void * args) {
-    scenario_t *scenario = (scenario_t *) args;
-    while (scenario->state != COMPLETE) {
-        pthread_mutex_lock(&scenario->mutex);
-        if (isScenarioComplete(scenario) == 1) {
-            pthread_mutex_unlock(&scenario->mutex);
-            pthread_exit(NULL);
-        }
-        if (scenario->state == SETUP) {
-            pthread_mutex_unlock(&scenario->mutex);
-            pthread_barrier_wait(&scenario->solutionSetup_barrier);
-            pthread_mutex_lock(&scenario->mutex);
-        }
+// A wheel finished the cycle; the last one hands over to the monitor.
+void wheelArrive(scenario_t *scenario) {
+    if (atomic_fetch_sub(&scenario->pendingWheels, 1) == 1) {
+        executor_submit(scenario->executor, &scenario->monitorTask);
+    }
+}
 
-        log_print(&scenario->log, "Freehandler: waiting for signal...\n");
-        while(scenario->state != PROBLEM) {
-            pthread_cond_wait(&scenario->conditions.freeWheeling_condition, &scenario->mutex);
-            if (scenario->state == COMPLETE) {
-                pthread_mutex_unlock(&scenario->mutex);
-                pthread_exit(NULL);
-            }
-        }
-        log_print(&scenario->log, "FreeHandler: Signal Received, searching for problem\n");
-        for (int i = 0; i < NUM_WHEELS; i++) {
-            int result = trySolveProblem(scenario, &scenario->wheels[i], FREEWHEELING);
-            if (result == 1) {
-                log_print(&scenario->log, "Terminating Scenario...\n");
-                scenario->state = COMPLETE;
-                scenario->outcome = FAILED;
-                break;
-            }
+/*
+ * Function: monitorStepTask
+ * --------------------------
+ * scenarioMonitor for one cycle. Schedules the next cycle cycleMs later
+ * (immediately with VIRTUAL_TIME), or ends the wheels once finished.
+ * */
+void monitorStepTask(executor_task_t *task) {
+    scenario_t *scenario = (scenario_t *)task->arg;
+    sync_mutex_lock(&scenario->mutex);
+    if (closeCycle(scenario) == 1) {
+        for (int i = 0; i < scenario->wheels.count; i++) {
+            scenarioLog(scenario, EV_WHEEL_EXITING, i, HANDLER_NONE, 0);
         }
-        scenario->state = scenario->outcome == FAILED ? COMPLETE: VECTORING;
-        log_print(&scenario->log, "Freehandler: signaling & releasing lock...\n");
-        pthread_cond_broadcast(&scenario->continue_condition);
-        pthread_mutex_unlock(&scenario->mutex);
-
+        // scenario_run may free the scenario as soon as the mutex is released.
+        sync_mutex_unlock(&scenario->mutex);
+        return;
     }
-    pthread_exit(NULL);
+    scenario->pendingWheels = scenario->wheels.count;
+    sync_mutex_unlock(&scenario->mutex);
+    if (clockMode == REAL_TIME)
+        executor_submit_after(scenario->executor, &scenario->cycleTask, (uint64_t)cycleMs * 1000000ull);
+    else
+        executor_submit(scenario->executor, &scenario->cycleTask);
 }
 
-int trySolveProblem(scenario_t *scenario, wheel_t * wheel, wheel_state pType) {
-    shared_buffer_t *log = &scenario->log;
+int trySolveProblem(scenario_t *scenario, int wheel, wheel_state pType) {
     int attempts = 0;
-    char msg[255];
-    char *logName = getLogNameForProblemType(pType);
+    log_handler handler = getHandlerForProblemType(pType);
+    _Atomic(wheel_state) *state = &scenario->wheels.state[wheel];
     int rando_calrissian;
-    if (wheel->state == pType) {
-        sprintf(msg, "%s: Resolving problem for wheel %d\n", logName, wheel->id);
-        log_print(&scenario->log, msg);
-        while(wheel->state != WORKING && attempts < PROBLEM_RETRY_ATTEMPTS) {
-            rando_calrissian = rand() % 100;
+    if (*state == pType) {
+        scenarioLog(scenario, EV_PROBLEM_RESOLVING, wheel, handler, 0);
+        while(*state != WORKING && attempts < PROBLEM_RETRY_ATTEMPTS) {
+            rando_calrissian = solveDraw(scenario, wheel);
             if (rando_calrissian >= FAILURE_PROBABILITY) {
-                wheel->state = WORKING;
-                sprintf(msg, "%s: Problem Solved\n", logName);
-                log_print(log, msg);
+                setWheelState(scenario, wheel, WORKING, 0);
+                scenarioLog(scenario, EV_PROBLEM_SOLVED, wheel, handler, 0);
                 return 0;
             }
             else {
-                sprintf(msg, "%s: Failed to solved problem, attempt: %d\n", logName, attempts + 1);
-                log_print(&scenario->log, msg);
+                scenarioLog(scenario, EV_PROBLEM_ATTEMPT, wheel, handler, attempts + 1);
                 attempts++;
             }
         }
 
         // Failed to solve problem 3 times.
-        sprintf(msg, "%s: Failed to solve problem after 3 Attempts...\n", logName);
-        log_print(log, msg);
+        scenarioLog(scenario, EV_PROBLEM_GAVE_UP, wheel, handler, 0);
         return 1;
     }
     return 0;
 }
 
-char *getLogNameForProblemType(wheel_state pType) {
-    static char name[20];
+log_handler getHandlerForProblemType(wheel_state pType) {
     switch (pType) {
         case SINKING:
-            strcpy(name, "SinkHandler");
-            break;
+            return HANDLER_SINK;
         case FREEWHEELING:
-            strcpy(name, "FreeHandler");
-            break;
+            return HANDLER_FREE;
         case BLOCKED:
-            strcpy(name, "BlockHandler");
-            break;
+            return HANDLER_BLOCK;
+        default:
+            return HANDLER_NONE;
     }
-    return name;
 }
 
 int isScenarioComplete(scenario_t *scenario) {
@@ -597,8 +1528,20 @@ int isScenarioComplete(scenario_t *scenario) {
     return 0;
 }
 
-wheel_state getRandomizedWheelState() {
-    int r = rand() % 100;
+/*
+ * Function: wheelDraw
+ * --------------------------
+ * A wheel's random number for the current cycle, 0 to 99. Each wheel
+ * has its own stream of the scenario seed, indexed by cycle, so the
+ * draw depends on nothing but the seed, the wheel and the cycle, and
+ * any wheel can work out another's.
+ * */
+unsigned int wheelDraw(scenario_t *scenario, int wheel) {
+    return rng_below(rng_at(rng_derive(scenario->seed, (uint64_t)wheel), scenario->cycle), 100);
+}
+
+// Maps a draw of 0 to 99 onto a wheel state.
+wheel_state getRandomizedWheelState(int r) {
     if (r <= 70 ) {
         return WORKING;
     }
@@ -613,32 +1556,47 @@ wheel_state getRandomizedWheelState() {
     }
 }
 
-wheel_state randomizeStateForScenario(scenario_t *scenario) {
+/*
+ * Draws a wheel's state for the cycle and counts it in
+ * currentCycleProblems if it is a problem. Single-problem scenarios
+ * allow one problem per cycle: it goes to the lowest-numbered wheel
+ * that draws it, whatever order the wheels run in, and the rest keep
+ * working. Checking the lower wheels' draws stops at the first problem,
+ * so it costs a few draws on average.
+ * */
+wheel_state randomizeStateForScenario(scenario_t *scenario, int wheel) {
+    wheel_state state;
+    wheel_state problem;
     switch (scenario->type) {
         case ROCK_1:
-            if (scenario->currentCycleProblems >= 1)
-                return WORKING;
-            else return randomizeSingleState(BLOCKED);
         case SINK_1:
-            if (scenario->currentCycleProblems >= 1)
-                return WORKING;
-            else return randomizeSingleState(SINKING);
         case FREE_1:
             if (scenario->currentCycleProblems >= 1)
                 return WORKING;
-            else return randomizeSingleState(FREEWHEELING);
+            problem = scenario->type == ROCK_1 ? BLOCKED : scenario->type == SINK_1 ? SINKING : FREEWHEELING;
+            state = randomizeSingleState((int)wheelDraw(scenario, wheel), problem);
+            if (state == WORKING)
+                return WORKING;
+            for (int lower = 0; lower < wheel; lower++) {
+                if (randomizeSingleState((int)wheelDraw(scenario, lower), problem) != WORKING)
+                    return WORKING;
+            }
+            scenario->currentCycleProblems = 1;
+            return state;
         case MULTI:
-            return getRandomizedWheelState();
+            state = getRandomizedWheelState((int)wheelDraw(scenario, wheel));
+            if (state != WORKING)
+                scenario->currentCycleProblems += 1;
+            return state;
     }
 }
 
 /*
  * @name: randomizeSingleState
- * @description: Has a 25% chance to return the wheel state specified in secondaryState,
- *  returns WORKING by default
+ * @description: Returns the wheel state specified in secondaryState for a quarter of
+ *  the draws r (0 to 99), WORKING otherwise
  * @returns wheel_state */
-wheel_state randomizeSingleState(wheel_state secondaryState) {
-    int r = rand() % 100;
+wheel_state randomizeSingleState(int r, wheel_state secondaryState) {
     if (r <= 75 )
         return WORKING;
     if (r <= 100)
@@ -651,147 +1609,190 @@ wheel_state randomizeSingleState(wheel_state secondaryState) {
  * Checks the Scenario state after each wheel cycle,
  * It increments the total Distance Vectored each Iteration.
  * Responsible for Signalling that the scenario has completed.
+ * Waits on the cycle barrier twice per cycle: once for the wheels to
+ * finish the cycle and once to release them with the verdict.
  *
  * p_scenario: Pointer to a scenario struct.
  *
  * returns: NULL
- * pthread_exit status: 0
  * */
 void *scenarioMonitor(void *p_scenario) {
     scenario_t *scenario = (scenario_t *)p_scenario;
-    pthread_mutex_t *mutex = &scenario->mutex;
-    shared_buffer_t *log = &scenario->log;
-    char msg[255];
-    while(1) {
-        //sprintf(msg, "SMon: Waiting at barrier\n");
-        //log_print(log, msg);
-        pthread_barrier_wait(&scenario->wheelCycle_barrier);
-        pthread_mutex_lock(mutex);
-        sprintf(msg, "TOTAL DISTANCE VECTORED: %f\n", scenario->totalDistanceVectored);
-        log_print(log, "==========================\n");
-        log_print(log, msg);
-        log_print(log, "==========================\n");
-        scenario->totalDistanceVectored += 0.1;
-        scenario->currentCycleProblems = 0;
-        scenario->multiReset = 0;
-        if (isScenarioComplete(scenario) == 1) {
-            if (scenario->state != COMPLETE) {
-                scenario->state = COMPLETE;
-            }
-            if (scenario->outcome != FAILED) {
-                scenario->outcome = PASSED;
-            }
-            pthread_cond_broadcast(&scenario->scenarioComplete_condition);
-            pthread_mutex_unlock(mutex);
-            break;
-        }
-        pthread_mutex_unlock(mutex);
+    sync_mutex_t *mutex = &scenario->mutex;
+    unsigned int monitorId = scenario->wheels.count; // Wheels are 0 to count - 1.
+    int complete = 0;
+    while(!complete) {
+        sync_barrier_wait(&scenario->wheelCycle_barrier, monitorId);
+        sync_mutex_lock(mutex);
+        complete = closeCycle(scenario);
+        sync_mutex_unlock(mutex);
+        sync_barrier_wait(&scenario->wheelCycle_barrier, monitorId);
     }
     // printf("SCMON: Exiting");
-    pthread_exit(0);
+    return NULL;
+}
+
+/*
+ * Function: traceTurn
+ * --------------------------
+ * Puts a transition in the trace order. Recording appends it. Replaying
+ * waits until it is the next record (releasing the mutex meanwhile, so
+ * the threads due before it can run), then moves the cursor on.
+ * Called with the mutex held.
+ *
+ * recorded: 1 if the replay should take the value from the trace (a
+ *  random outcome), 0 if value must match it.
+ *
+ * returns: the value to apply, or -1 if a replayed wheel's problem was
+ * overtaken by the scenario completing. The wheel checked for that
+ * before waiting its turn, so a recorded run may never have raised it.
+ * */
+int traceTurn(scenario_t *scenario, trace_kind kind, int wheel, int value, int recorded) {
+    trace_t *trace = scenario->trace;
+    if (scenario->tracing == RECORDING) {
+        if (trace_append(trace, kind, wheel, value) != 0) {
+            printf("ERROR(traceTurn); could not grow the trace\n");
+            exit(-1);
+        }
+        return value;
+    }
+    while (1) {
+        if (trace->cursor >= trace->count) {
+            printf("ERROR(replay); ran past the end of the trace (kind %d, wheel %d)\n", kind, wheel);
+            exit(-1);
+        }
+        trace_record_t *next = &trace->records[trace->cursor];
+        if (next->kind == kind && next->wheel == (uint16_t)wheel)
+            break;
+        if (kind == TRACE_SCENARIO_STATE && value == PROBLEM && scenario->state == COMPLETE)
+            return -1;
+        sync_cond_wait(&scenario->turn_condition, &scenario->mutex);
+    }
+    trace_record_t *next = &trace->records[trace->cursor];
+    if (!recorded && next->value != (uint8_t)value) {
+        printf("ERROR(replay); diverged at record %zu: kind %d, wheel %d, value %d, traced %d\n",
+               trace->cursor, kind, wheel, value, next->value);
+        exit(-1);
+    }
+    trace->cursor++;
+    sync_cond_broadcast(&scenario->turn_condition);
+    return next->value;
 }
 
-shared_buffer_t log_init(scenario_type scType) {
-    shared_buffer_t sb;
-    sb.next_in = sb.next_out = sb.count = 0;
-    sb.close = 0;
-    pthread_mutex_init(&sb.lock, NULL);
-    pthread_cond_init(&sb.new_data_cond, NULL);
-    pthread_cond_init(&sb.new_space_cond, NULL);
+/*
+ * Sets a wheel's state. drawn: state is a random draw, which a replay
+ * replaces with the recorded one. Called without the mutex.
+ *
+ * returns: the state set.
+ * */
+wheel_state setWheelState(scenario_t *scenario, int wheel, wheel_state state, int drawn) {
+    if (scenario->tracing != NO_TRACE) {
+        sync_mutex_lock(&scenario->mutex);
+        state = (wheel_state)traceTurn(scenario, TRACE_WHEEL_STATE, wheel, state, drawn);
+        scenario->wheels.state[wheel] = state;
+        sync_mutex_unlock(&scenario->mutex);
+        return state;
+    }
+    scenario->wheels.state[wheel] = state;
+    return state;
+}
 
-    // Gen FileName for scenario
-    sb.fileName = generateFileName(scType);
+/*
+ * Sets the scenario state on behalf of wheel (LOG_NO_WHEEL for none).
+ * Called with the mutex held.
+ *
+ * returns: 0, or -1 if a replay found the scenario complete instead
+ * (see traceTurn) and left the state alone.
+ * */
+int setScenarioState(scenario_t *scenario, int wheel, scenario_state state) {
+    if (scenario->tracing != NO_TRACE && traceTurn(scenario, TRACE_SCENARIO_STATE, wheel, state, 0) < 0)
+        return -1;
+    scenario->state = state;
+    return 0;
+}
 
-    return sb;
+// Draws 0 to 99 for a fix attempt on wheel's problem. Called without the mutex.
+int solveDraw(scenario_t *scenario, int wheel) {
+    int r = (int)rng_below(rng_next(&scenario->solveRng), 100);
+    if (scenario->tracing != NO_TRACE) {
+        sync_mutex_lock(&scenario->mutex);
+        r = traceTurn(scenario, TRACE_DRAW, wheel, r, 1);
+        sync_mutex_unlock(&scenario->mutex);
+    }
+    return r;
 }
 
-void log_destroy(shared_buffer_t *sb) {
-    pthread_mutex_destroy(&sb->lock);
-    pthread_cond_destroy(&sb->new_data_cond);
-    pthread_cond_destroy(&sb->new_space_cond);
-    return;
+/*
+ * Function: closeCycle
+ * --------------------------
+ * Monitor step once every wheel has finished the cycle: adds the
+ * distance vectored, advances the cycle and simulated time and flags
+ * the scenario finished if it is complete. Called with the mutex held.
+ *
+ * returns: 1 if the scenario finished, 0 otherwise.
+ * */
+int closeCycle(scenario_t *scenario) {
+    BENCH_RECORD(cycleLatency, scenario->cycleStartNs);
+    uint64_t now = hist_now();
+    if (scenario->cycleTimes != NULL)
+        hist_record(scenario->cycleTimes, now - scenario->cycleStartNs);
+    scenario->cycleStartNs = now;
+    scenarioLog(scenario, EV_DISTANCE, LOG_NO_WHEEL, HANDLER_NONE, scenario->totalDistanceVectored);
+    scenario->totalDistanceVectored += 0.1;
+    scenario->cycle++;
+    if (scenario->tracing != NO_TRACE)
+        traceTurn(scenario, TRACE_CYCLE, LOG_NO_WHEEL, (int)(scenario->cycle & 0xFF), 0);
+    // Simulated time moves one cycle period at a time, so every record of a cycle shares its time.
+    atomic_store_explicit(&scenario->simTime, (unsigned long long)scenario->cycle * cycleMs * 1000000ull,
+                          memory_order_relaxed);
+    scenario->currentCycleProblems = 0;
+    scenario->multiReset = 0;
+    if (isScenarioComplete(scenario) == 1) {
+        if (scenario->state != COMPLETE) {
+            setScenarioState(scenario, LOG_NO_WHEEL, COMPLETE);
+        }
+        if (scenario->outcome != FAILED) {
+            scenario->outcome = PASSED;
+        }
+        sync_cond_broadcast(&scenario->scenarioComplete_condition);
+        scenario->finished = 1;
+        return 1;
+    }
+    return 0;
 }
 
-char * generateFileName(scenario_type scType) {
-    static char fn[30];
-    int prefLen =0;
+/*
+ * Builds the log file name: scenario type, local time to the minute and,
+ * for batch runs (run >= 0), the run number, so that scenarios running
+ * at the same time each get their own file.
+ * */
+char *generateFileName(scenario_type scType, int run, char *fn, size_t len) {
+    const char *prefix = "";
     switch(scType) {
         case ROCK_1:
-            prefLen = 4;
-            memcpy(fn, "Rock", prefLen);
+            prefix = "Rock";
             break;
         case SINK_1:
-            prefLen = 4;
-            memcpy(fn, "Sink", prefLen);
+            prefix = "Sink";
             break;
         case FREE_1:
-            prefLen = 4;
-            memcpy(fn, "Free", prefLen);
+            prefix = "Free";
             break;
         case MULTI:
-            prefLen = 5;
-            memcpy(fn, "Multi", prefLen);
+            prefix = "Multi";
             break;
     }
 
     char timeText[17];
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    strftime(timeText, sizeof(timeText), "%d-%m-%Y-%H:%M", t);
-
-    memcpy(fn + prefLen, timeText, 16);
-    memcpy(fn + prefLen + 16, ".txt", 4);
+    struct tm t;
+    localtime_r(&now, &t);
+    strftime(timeText, sizeof(timeText), "%d-%m-%Y-%H:%M", &t);
+
+    const char *ext = logConfig.format == LOG_FORMAT_BINARY ? ".bin" : ".txt";
+    if (run >= 0)
+        snprintf(fn, len, "%s%s-%d%s", prefix, timeText, run, ext);
+    else
+        snprintf(fn, len, "%s%s%s", prefix, timeText, ext);
     return fn;
 }
-
-/* producer is intended to be the body of a thread.
-   It repeatedly reads the next line of text from the standard input,
-   and puts it into the buffer pointed to by the parameter sb.
-   It terminates when it encounters an EOF character in input.
-   The EOF character is passed on to the consumer.
- */
-void *log_print(shared_buffer_t *sb, char string[]) {
-    printf("%s", string);
-    pthread_mutex_lock(&sb->lock);
-    // Wait for space
-    while (sb->count == BUFF_H)
-        pthread_cond_wait(&sb->new_space_cond, &sb->lock);
-
-    // Copy string in buffer
-    strcpy(sb->c[sb->next_in], string);
-    sb->count++;
-    sb->next_in = (sb->next_in + 1) % BUFF_H;
-    pthread_mutex_unlock(&sb->lock);
-    pthread_cond_signal(&sb->new_data_cond);
-    return NULL;
-}
-
-void *log_consume(void *args) {
-    shared_buffer_t *sb = (shared_buffer_t *)args;
-    FILE *fp;
-    fp = fopen(sb->fileName,"a");
-    if (fp == NULL) {
-        perror( "Error opening file" );
-        printf( "Error code opening file: %d\n", errno );
-        printf( "Error opening file: %s\n", strerror( errno ) );
-        exit(-1);
-    }
-    for (;;) {
-        pthread_mutex_lock(&sb->lock);
-        while(sb->count == 0 && sb->close == 0)
-            pthread_cond_wait(&sb->new_data_cond, &sb->lock);
-
-        if (sb->close == 1) {
-            fclose(fp);
-            pthread_exit(NULL);
-        }
-        pthread_mutex_unlock(&sb->lock);
-        fprintf(fp, "%s", sb->c[sb->next_out]);
-        memset(sb->c[sb->next_out], '\0', sizeof(sb->c[sb->next_out]));
-        pthread_mutex_lock(&sb->lock);
-        sb->next_out = (sb->next_out + 1) % BUFF_H;
-        sb->count--;
-        pthread_mutex_unlock(&sb->lock);
-        pthread_cond_signal(&sb->new_space_cond);
-    }
-}
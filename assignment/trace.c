@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// returns: 0 on success, -1 if the record buffer could not be allocated.
+int trace_init(trace_t *t, uint32_t type, uint32_t wheels, uint64_t seed) {
+    memset(t, 0, sizeof(*t));
+    memcpy(t->header.magic, TRACE_MAGIC, sizeof(t->header.magic));
+    t->header.version = TRACE_VERSION;
+    t->header.type = type;
+    t->header.wheels = wheels;
+    t->header.seed = seed;
+    t->records = malloc(TRACE_INITIAL_CAPACITY * sizeof(trace_record_t));
+    if (t->records == NULL)
+        return -1;
+    t->capacity = TRACE_INITIAL_CAPACITY;
+    return 0;
+}
+
+// Not thread safe: the caller orders appends. returns: 0, or -1 if the buffer could not grow.
+int trace_append(trace_t *t, trace_kind kind, int wheel, int value) {
+    if (t->count == t->capacity) {
+        trace_record_t *grown = realloc(t->records, 2 * t->capacity * sizeof(trace_record_t));
+        if (grown == NULL)
+            return -1;
+        t->records = grown;
+        t->capacity *= 2;
+    }
+    t->records[t->count++] = (trace_record_t){(uint8_t)kind, (uint8_t)value, (uint16_t)wheel};
+    return 0;
+}
+
+/*
+ * Function: trace_save
+ * --------------------------
+ * Writes the header and records to path, in host byte order.
+ *
+ * returns: 0 on success, -1 otherwise.
+ * */
+int trace_save(const trace_t *t, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return -1;
+    trace_header_t header = t->header;
+    header.count = t->count;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1
+             && fwrite(t->records, sizeof(trace_record_t), t->count, fp) == t->count;
+    return fclose(fp) == 0 && ok ? 0 : -1;
+}
+
+/*
+ * Function: trace_load
+ * --------------------------
+ * Reads a trace written by trace_save, ready to replay from the start.
+ *
+ * returns: 0 on success, -1 if path cannot be read or is not a trace.
+ * */
+int trace_load(trace_t *t, const char *path) {
+    memset(t, 0, sizeof(*t));
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    if (fread(&t->header, sizeof(t->header), 1, fp) != 1
+        || memcmp(t->header.magic, TRACE_MAGIC, sizeof(t->header.magic)) != 0
+        || t->header.version != TRACE_VERSION) {
+        fclose(fp);
+        return -1;
+    }
+    t->count = t->header.count;
+    t->capacity = t->count;
+    t->records = malloc((t->count > 0 ? t->count : 1) * sizeof(trace_record_t));
+    if (t->records == NULL || fread(t->records, sizeof(trace_record_t), t->count, fp) != t->count) {
+        fclose(fp);
+        trace_free(t);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+void trace_free(trace_t *t) {
+    free(t->records);
+    t->records = NULL;
+    t->count = 0;
+    t->capacity = 0;
+}
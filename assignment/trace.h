@@ -0,0 +1,52 @@
+#ifndef ASSIGNMENT_TRACE_H
+#define ASSIGNMENT_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "WTRC"
+#define TRACE_VERSION 1
+#define TRACE_INITIAL_CAPACITY 4096 // Records; the buffer doubles as needed.
+
+/*
+ * What a trace record orders. Records are written in the order the
+ * transitions happened, and a replay makes them happen in that order.
+ */
+typedef enum trace_kind {
+    TRACE_WHEEL_STATE,    // A wheel's state changed: value is the new state.
+    TRACE_SCENARIO_STATE, // The scenario state changed: value is the new state.
+    TRACE_DRAW,           // A problem fix attempt's random draw: value is 0 to 99.
+    TRACE_CYCLE           // The monitor closed a cycle: value is its low byte.
+} trace_kind;
+
+// 4 bytes. wheel is the wheel concerned, or that caused the change (LOG_NO_WHEEL for none).
+typedef struct trace_record {
+    uint8_t kind;
+    uint8_t value;
+    uint16_t wheel;
+} trace_record_t;
+
+typedef struct trace_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t type;   // scenario_type
+    uint32_t wheels;
+    uint64_t seed;   // Scenario seed, for reference; replays take every draw from the records.
+    uint64_t count;  // Records that follow.
+} trace_header_t;
+
+typedef struct trace {
+    trace_header_t header;
+    trace_record_t *records;
+    size_t count;
+    size_t capacity;
+    size_t cursor; // Next record to replay.
+} trace_t;
+
+int trace_init(trace_t *t, uint32_t type, uint32_t wheels, uint64_t seed);
+int trace_append(trace_t *t, trace_kind kind, int wheel, int value);
+int trace_save(const trace_t *t, const char *path);
+int trace_load(trace_t *t, const char *path);
+void trace_free(trace_t *t);
+
+#endif //ASSIGNMENT_TRACE_H
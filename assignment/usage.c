@@ -0,0 +1,63 @@
+#define _GNU_SOURCE
+#include <time.h>
+#include <sys/resource.h>
+
+#include "usage.h"
+
+static uint64_t clockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t timevalNs(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000000ull + (uint64_t)tv->tv_usec * 1000ull;
+}
+
+// Snapshots the calling thread's clocks and counters.
+void usage_mark(usage_mark_t *mark) {
+    mark->wallNs = clockNs(CLOCK_MONOTONIC);
+    mark->cpuNs = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    getrusage(RUSAGE_THREAD, &mark->ru);
+}
+
+/*
+ * Function: usage_since
+ * --------------------------
+ * Adds what the calling thread has used since mark, which it must have
+ * taken itself, to u as one more interval.
+ * */
+void usage_since(thread_usage_t *u, const usage_mark_t *mark) {
+    usage_mark_t now;
+    usage_mark(&now);
+    u->count++;
+    u->wallNs += now.wallNs - mark->wallNs;
+    u->cpuNs += now.cpuNs - mark->cpuNs;
+    u->userNs += timevalNs(&now.ru.ru_utime) - timevalNs(&mark->ru.ru_utime);
+    u->systemNs += timevalNs(&now.ru.ru_stime) - timevalNs(&mark->ru.ru_stime);
+    u->voluntary += now.ru.ru_nvcsw - mark->ru.ru_nvcsw;
+    u->involuntary += now.ru.ru_nivcsw - mark->ru.ru_nivcsw;
+}
+
+void usage_add(thread_usage_t *total, const thread_usage_t *u) {
+    total->count += u->count;
+    total->wallNs += u->wallNs;
+    total->cpuNs += u->cpuNs;
+    total->userNs += u->userNs;
+    total->systemNs += u->systemNs;
+    total->voluntary += u->voluntary;
+    total->involuntary += u->involuntary;
+}
+
+void usage_report_header(FILE *out) {
+    fprintf(out, "  %-16s %6s %10s %10s %10s %10s %10s %10s %10s\n", "thread", "n", "wall ms", "cpu ms",
+            "user ms", "sys ms", "blocked ms", "vol cs", "invol cs");
+}
+
+// One row of the table; blocked is wall time off the CPU.
+void usage_report_row(const char *name, const thread_usage_t *u, FILE *out) {
+    uint64_t blockedNs = u->wallNs > u->cpuNs ? u->wallNs - u->cpuNs : 0;
+    fprintf(out, "  %-16s %6lu %10.3f %10.3f %10.3f %10.3f %10.3f %10ld %10ld\n", name, u->count,
+            (double)u->wallNs / 1e6, (double)u->cpuNs / 1e6, (double)u->userNs / 1e6,
+            (double)u->systemNs / 1e6, (double)blockedNs / 1e6, u->voluntary, u->involuntary);
+}
@@ -0,0 +1,37 @@
+#ifndef ASSIGNMENT_USAGE_H
+#define ASSIGNMENT_USAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+/*
+ * What a thread used between two points in its life, or the sum over
+ * several threads or intervals. Wall time not spent on the CPU was
+ * spent blocked: voluntary switches say it was asleep (a lock, condition,
+ * futex or timed sleep), involuntary ones that it was preempted.
+ */
+typedef struct thread_usage {
+    unsigned long count; // Threads or intervals summed.
+    uint64_t wallNs;
+    uint64_t cpuNs;      // CLOCK_THREAD_CPUTIME_ID.
+    uint64_t userNs;     // getrusage(RUSAGE_THREAD) from here on.
+    uint64_t systemNs;
+    long voluntary;
+    long involuntary;
+} thread_usage_t;
+
+// Where the calling thread stood; see usage_since.
+typedef struct usage_mark {
+    uint64_t wallNs;
+    uint64_t cpuNs;
+    struct rusage ru;
+} usage_mark_t;
+
+void usage_mark(usage_mark_t *mark);
+void usage_since(thread_usage_t *u, const usage_mark_t *mark);
+void usage_add(thread_usage_t *total, const thread_usage_t *u);
+void usage_report_header(FILE *out);
+void usage_report_row(const char *name, const thread_usage_t *u, FILE *out);
+
+#endif //ASSIGNMENT_USAGE_H